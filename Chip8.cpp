@@ -1,9 +1,16 @@
 #include <cstdint>
 #include <fstream>
 #include <chrono>
-#include <random>
+#include <type_traits>
+#include <utility>
+#include <cstring>
+#include <algorithm>
+#include <iomanip>
+#include <ostream>
 
 #include "Chip8.hpp"
+#include "Debugger.hpp"
+#include "Trace.hpp"
 
 
 
@@ -41,6 +48,32 @@ uint8_t FONTSET[NUM_FONT_CHARACTERS * 5] =
 	0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
+//SUPER-CHIP and XO-CHIP also have big 8x10 font sprites, stored right after the small ones
+const unsigned int BIG_FONT_ADDRESS = 0xA0;
+
+uint8_t BIG_FONTSET[NUM_FONT_CHARACTERS * 10] =
+{
+	0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+	0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+	0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+	0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+	0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+	0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+	0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+	0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+	0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+	0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+	0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+	0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+};
+
+//Colors of a pixel depending on which planes have it turned on (off, plane 1, plane 2, both)
+const uint32_t PIXEL_COLORS[4] = { 0x00000000, 0xFFFFFFFF, 0xAAAAAAFF, 0x555555FF };
+
 
 
 
@@ -48,11 +81,11 @@ uint8_t FONTSET[NUM_FONT_CHARACTERS * 5] =
 
 //CHIP8 constructor which:
 //-Sets the program counter register to the first instruction address, which is where the memory where the program is stored starts
-//-Sets the random number generator and distribution
-//-Creates the table of opcode to function mappings
-Chip8::Chip8()
-    : randGen(std::chrono::system_clock::now().time_since_epoch().count()),
-      randByte(std::uniform_int_distribution<unsigned int>(0, 255U)) //Apparently this is better for declaring vars in the constructor because it handles errors better and does default constructor
+//-Seeds the random number generator from the clock
+//-Loads the fonts into memory
+template <class Config>
+Chip8Machine<Config>::Chip8Machine()
+    : randomState(std::chrono::system_clock::now().time_since_epoch().count()) //Apparently this is better for declaring vars in the constructor because it handles errors better and does default constructor
 {
 
     programCounter = START_ADDRESS;
@@ -61,6 +94,24 @@ Chip8::Chip8()
         memory[FONT_ADDRESS + i] = FONTSET[i];
     }
 
+    if (SUPER) {
+        for (unsigned int i = 0; i < sizeof(BIG_FONTSET); ++i) {
+            memory[BIG_FONT_ADDRESS + i] = BIG_FONTSET[i];
+        }
+    }
+
+    if (Config::STATE_HASH) {
+        contentHash = hashMemory(0, MEMORY_SIZE); //The fonts are already in memory, and the display is empty
+    }
+
+}
+
+//Builds the opcode tables. This runs at compile time, so every machine of a type shares one set
+//of tables and the constructor has nothing to fill in
+template <class Config>
+constexpr typename Chip8Machine<Config>::OpcodeTables Chip8Machine<Config>::buildTables() {
+
+    OpcodeTables tables{};
 
     //Why is this the best strategy for mapping opcodes to functions? We could have a
     //set of if statements or a switch statement but that would be unweildy for a program
@@ -73,78 +124,138 @@ Chip8::Chip8()
     //opcodes which require more bits to check which distinct opcode it is.
 
     //Based on first digit
-    table[0x0] = &Chip8::Table0;
-    table[0x1] = &Chip8::JUMP_1nnn;
-    table[0x2] = &Chip8::CALL_2nnn;
-    table[0x3] = &Chip8::SE_3xkk;
-    table[0x4] = &Chip8::SNE_4xkk;
-    table[0x5] = &Chip8::SE_5xy0;
-    table[0x6] = &Chip8::LD_6xkk;
-    table[0x7] = &Chip8::ADD_7xkk;
-    table[0x8] = &Chip8::Table8;
-    table[0x9] = &Chip8::SNE_9xy0;
-    table[0xA] = &Chip8::LD_Annn;
-    table[0xB] = &Chip8::JP_Bnnn;
-    table[0xC] = &Chip8::RND_Cxkk;
-    table[0xD] = &Chip8::DRW_Dxyn;
-    table[0xE] = &Chip8::TableE;
-    table[0xF] = &Chip8::TableF;
-
-    std::fill(table0, table0 + sizeof(table0), &Chip8::OP_NULL);
-    std::fill(table8, table8 + sizeof(table8), &Chip8::OP_NULL);
-    std::fill(tableE, tableE + sizeof(tableE), &Chip8::OP_NULL);
-    std::fill(tableF, tableF + sizeof(tableF), &Chip8::OP_NULL);
+    tables.table[0x0] = &Chip8Machine::Table0;
+    tables.table[0x1] = &Chip8Machine::JUMP_1nnn;
+    tables.table[0x2] = &Chip8Machine::CALL_2nnn;
+    tables.table[0x3] = &Chip8Machine::SE_3xkk;
+    tables.table[0x4] = &Chip8Machine::SNE_4xkk;
+    tables.table[0x5] = &Chip8Machine::Table5;
+    tables.table[0x6] = &Chip8Machine::LD_6xkk;
+    tables.table[0x7] = &Chip8Machine::ADD_7xkk;
+    tables.table[0x8] = &Chip8Machine::Table8;
+    tables.table[0x9] = &Chip8Machine::SNE_9xy0;
+    tables.table[0xA] = &Chip8Machine::LD_Annn;
+    tables.table[0xB] = &Chip8Machine::JP_Bnnn;
+    tables.table[0xC] = &Chip8Machine::RND_Cxkk;
+    tables.table[0xD] = &Chip8Machine::DRW_Dxyn;
+    tables.table[0xE] = &Chip8Machine::TableE;
+    tables.table[0xF] = &Chip8Machine::TableF;
+
+    //Everything not filled in below is an unknown opcode
+    for (unsigned int i = 0; i <= 0xFF; ++i) {
+        tables.table0[i] = &Chip8Machine::OP_NULL;
+        tables.tableF[i] = &Chip8Machine::OP_NULL;
+    }
+    for (unsigned int i = 0; i <= 0xF; ++i) {
+        tables.table5[i] = &Chip8Machine::OP_NULL;
+        tables.table8[i] = &Chip8Machine::OP_NULL;
+        tables.tableE[i] = &Chip8Machine::OP_NULL;
+    }
+
+    //Based on third and fourth digit, since the SUPER-CHIP opcodes 00Cn and 00FE share a fourth digit with the others
+    tables.table0[0xE0] = &Chip8Machine::CLS_00E0;
+    tables.table0[0xEE] = &Chip8Machine::RET_00EE;
+
+    if (SUPER) {
+        for (unsigned int n = 0; n <= 0xF; ++n) {
+            tables.table0[0xC0 + n] = &Chip8Machine::SCD_00Cn;
+        }
+
+        tables.table0[0xFB] = &Chip8Machine::SCR_00FB;
+        tables.table0[0xFC] = &Chip8Machine::SCL_00FC;
+        tables.table0[0xFD] = &Chip8Machine::EXIT_00FD;
+        tables.table0[0xFE] = &Chip8Machine::LOW_00FE;
+        tables.table0[0xFF] = &Chip8Machine::HIGH_00FF;
+    }
+
+    if (XO) {
+        for (unsigned int n = 0; n <= 0xF; ++n) {
+            tables.table0[0xD0 + n] = &Chip8Machine::SCU_00Dn;
+        }
+    }
 
     //Based on fourth digit
-    table0[0x0] = &Chip8::CLS_00E0;
-    table0[0xE] = &Chip8::RET_00EE;
+    tables.table5[0x0] = &Chip8Machine::SE_5xy0;
+
+    if (XO) {
+        tables.table5[0x2] = &Chip8Machine::SAVE_5xy2;
+        tables.table5[0x3] = &Chip8Machine::LOAD_5xy3;
+    }
 
     //Based on fourth digit
-    table8[0x0] = &Chip8::LD_8xy0;
-    table8[0x1] = &Chip8::OR_8xy1;
-    table8[0x2] = &Chip8::AND_8xy2;
-    table8[0x3] = &Chip8::XOR_8xy3;
-    table8[0x4] = &Chip8::ADD_8xy4;
-    table8[0x5] = &Chip8::SUB_8xy5;
-    table8[0x6] = &Chip8::SHR_8xy6;
-    table8[0x7] = &Chip8::SUBN_8xy7;
-    table8[0xE] = &Chip8::SHL_8xyE;
+    tables.table8[0x0] = &Chip8Machine::LD_8xy0;
+    tables.table8[0x1] = &Chip8Machine::OR_8xy1;
+    tables.table8[0x2] = &Chip8Machine::AND_8xy2;
+    tables.table8[0x3] = &Chip8Machine::XOR_8xy3;
+    tables.table8[0x4] = &Chip8Machine::ADD_8xy4;
+    tables.table8[0x5] = &Chip8Machine::SUB_8xy5;
+    tables.table8[0x6] = &Chip8Machine::SHR_8xy6;
+    tables.table8[0x7] = &Chip8Machine::SUBN_8xy7;
+    tables.table8[0xE] = &Chip8Machine::SHL_8xyE;
 
     //Based on fourth digit
-    tableE[0x1] = &Chip8::SKP_Ex9E;
-	tableE[0xE] = &Chip8::SKNP_ExA1;
+    tables.tableE[0xE] = &Chip8Machine::SKP_Ex9E;
+    tables.tableE[0x1] = &Chip8Machine::SKNP_ExA1;
 
     //Based on third and fourth digit
-    tableF[0x07] = &Chip8::LD_Fx07;
-    tableF[0x0A] = &Chip8::LD_Fx0A;
-    tableF[0x15] = &Chip8::LD_Fx15;
-    tableF[0x18] = &Chip8::LD_Fx18;
-    tableF[0x1E] = &Chip8::ADD_Fx1E;
-    tableF[0x29] = &Chip8::LD_Fx29;
-    tableF[0x33] = &Chip8::LD_Fx33;
-    tableF[0x55] = &Chip8::LD_Fx55;
-    tableF[0x65] = &Chip8::LD_Fx65;
+    tables.tableF[0x07] = &Chip8Machine::LD_Fx07;
+    tables.tableF[0x0A] = &Chip8Machine::LD_Fx0A;
+    tables.tableF[0x15] = &Chip8Machine::LD_Fx15;
+    tables.tableF[0x18] = &Chip8Machine::LD_Fx18;
+    tables.tableF[0x1E] = &Chip8Machine::ADD_Fx1E;
+    tables.tableF[0x29] = &Chip8Machine::LD_Fx29;
+    tables.tableF[0x33] = &Chip8Machine::LD_Fx33;
+    tables.tableF[0x55] = &Chip8Machine::LD_Fx55;
+    tables.tableF[0x65] = &Chip8Machine::LD_Fx65;
+
+    if (SUPER) {
+        tables.tableF[0x30] = &Chip8Machine::LD_Fx30;
+        tables.tableF[0x75] = &Chip8Machine::LD_Fx75;
+        tables.tableF[0x85] = &Chip8Machine::LD_Fx85;
+    }
+
+    if (XO) {
+        tables.tableF[0x00] = &Chip8Machine::LD_F000;
+        tables.tableF[0x01] = &Chip8Machine::PLANE_Fn01;
+        tables.tableF[0x02] = &Chip8Machine::AUDIO_F002;
+        tables.tableF[0x3A] = &Chip8Machine::PITCH_Fx3A;
+    }
+
+    return tables;
 
 }
 
+template <class Config>
+constexpr typename Chip8Machine<Config>::OpcodeTables Chip8Machine<Config>::TABLES = Chip8Machine<Config>::buildTables();
+
 //Calls specific opcode if starting with 0x0
-void Chip8::Table0() {
-    ((*this).*(table0[opcode & 0x000Fu]))(); //Dereferencing both the class instance itself and its function to call it. Guess it may not be necessary but good practice? If there are free functions with the same name
+template <class Config>
+void Chip8Machine<Config>::Table0() {
+    ((*this).*(TABLES.table0[opcode & 0x00FFu]))(); //Dereferencing both the class instance itself and its function to call it. Guess it may not be necessary but good practice? If there are free functions with the same name
 }
 
-//Calls specific opcode if starting with 0x0
-void Chip8::Table8() {
-    ((*this).*(table8[opcode & 0x000Fu]))();
+//Calls specific opcode if starting with 0x5
+template <class Config>
+void Chip8Machine<Config>::Table5() {
+    ((*this).*(TABLES.table5[opcode & 0x000Fu]))();
 }
 
-//Calls specific opcode if starting with 0x0
-void Chip8::TableE() {
-    ((*this).*(tableE[opcode & 0x000Fu]))();
+//Calls specific opcode if starting with 0x8
+template <class Config>
+void Chip8Machine<Config>::Table8() {
+    ((*this).*(TABLES.table8[opcode & 0x000Fu]))();
 }
 
-//Calls specific opcode if starting with 0x0
-void Chip8::TableF() {
-    ((*this).*(tableF[opcode & 0x00FFu]))();
+//Calls specific opcode if starting with 0xE
+template <class Config>
+void Chip8Machine<Config>::TableE() {
+    ((*this).*(TABLES.tableE[opcode & 0x000Fu]))();
+}
+
+//Calls specific opcode if starting with 0xF
+template <class Config>
+void Chip8Machine<Config>::TableF() {
+    ((*this).*(TABLES.tableF[opcode & 0x00FFu]))();
 }
 
 
@@ -154,7 +265,8 @@ void Chip8::TableF() {
 //-----------------CLASS METHODS----------------
 
 //CHIP8 method which reads contents of a ROM file and loads it into memory
-void Chip8::loadROM(char const* fileName) {
+template <class Config>
+void Chip8Machine<Config>::loadROM(char const* fileName) {
 
     //Creates file object from file name
     //Created as a stream of binary and moving pointer at the end of file
@@ -165,6 +277,12 @@ void Chip8::loadROM(char const* fileName) {
         //Finds file size by getting current position of the file
         //Then creates an array of that size which will hold the ROM contents
         std::streampos fileSize = file.tellg();
+
+        //ROMs bigger than the memory after the start address would not fit
+        if (fileSize > MEMORY_SIZE - START_ADDRESS) {
+            fileSize = MEMORY_SIZE - START_ADDRESS;
+        }
+
         char* buffer = new char[fileSize];
 
         //Moves pointer to beginning of file
@@ -174,10 +292,33 @@ void Chip8::loadROM(char const* fileName) {
         file.close();
 
         //Loads file contents into CHIP8 memory
-        for (int i = 0; i < fileSize; ++i) {
-            memory[START_ADDRESS + i] = buffer[i];
-        }
+        loadROM(reinterpret_cast<uint8_t const*>(buffer), fileSize);
 
+        delete[] buffer;
+
+    }
+
+}
+
+//CHIP8 method which loads a ROM that is already in memory, such as one received over a socket
+template <class Config>
+void Chip8Machine<Config>::loadROM(uint8_t const* data, size_t size) {
+
+    //ROMs bigger than the memory after the start address would not fit
+    if (size > MEMORY_SIZE - START_ADDRESS) {
+        size = MEMORY_SIZE - START_ADDRESS;
+    }
+
+    //One copy, with the range taken out of the hash before and added back after, rather than a
+    //hash update per byte. Fuzzers load a ROM for every case
+    if (Config::STATE_HASH) {
+        contentHash ^= hashMemory(START_ADDRESS, size);
+    }
+
+    memcpy(&memory[START_ADDRESS], data, size);
+
+    if (Config::STATE_HASH) {
+        contentHash ^= hashMemory(START_ADDRESS, size);
     }
 
 }
@@ -193,64 +334,165 @@ void Chip8::loadROM(char const* fileName) {
 //Opcode instructions
 
 
-//Clears display
-void Chip8::CLS_00E0() {
-    memset(display, 0, sizeof(display));
+//Clears display (only the selected planes on XO-CHIP)
+template <class Config>
+void Chip8Machine<Config>::CLS_00E0() {
+    for (unsigned int plane = 0; plane < PLANES; ++plane) {
+        if (planeMask & (1u << plane)) {
+            unsigned int first = plane * VIDEO_HEIGHT * DISPLAY_WORDS;
+
+            if (Config::STATE_HASH) {
+                contentHash ^= hashDisplay(first, VIDEO_HEIGHT * DISPLAY_WORDS); //Cleared words hash to 0, so only the old words need removing
+            }
+            memset(&display[first], 0, sizeof(display) / PLANES);
+        }
+    }
 }
 
 //Returns from a subroutine
-void Chip8::RET_00EE() {
-    --stackPointer;
+//The stack pointer wraps around within the 16 entries, so unbalanced returns can't read outside the stack
+template <class Config>
+void Chip8Machine<Config>::RET_00EE() {
+    stackPointer = (stackPointer - 1) & 0x0Fu;
     programCounter = stack[stackPointer];
 }
 
+//Scrolls display down n pixels (SUPER-CHIP)
+template <class Config>
+void Chip8Machine<Config>::SCD_00Cn() {
+    uint8_t n = opcode & 0x000Fu;
+
+    scrollRows(n);
+}
+
+//Scrolls display up n pixels (XO-CHIP)
+template <class Config>
+void Chip8Machine<Config>::SCU_00Dn() {
+    uint8_t n = opcode & 0x000Fu;
+
+    scrollRows(-n);
+}
+
+//Scrolls display right 4 pixels (SUPER-CHIP)
+template <class Config>
+void Chip8Machine<Config>::SCR_00FB() {
+    scrollColumns(4);
+}
+
+//Scrolls display left 4 pixels (SUPER-CHIP)
+template <class Config>
+void Chip8Machine<Config>::SCL_00FC() {
+    scrollColumns(-4);
+}
+
+//Exits the interpreter (SUPER-CHIP)
+template <class Config>
+void Chip8Machine<Config>::EXIT_00FD() {
+    halted = true;
+}
+
+//Switches to low resolution 64x32 mode, where each pixel is drawn as a 2x2 block (SUPER-CHIP)
+template <class Config>
+void Chip8Machine<Config>::LOW_00FE() {
+    highResolution = false;
+}
+
+//Switches to high resolution mode, using the full display (SUPER-CHIP)
+template <class Config>
+void Chip8Machine<Config>::HIGH_00FF() {
+    highResolution = true;
+}
+
 //Jumps to new address without adding to stack
-void Chip8::JUMP_1nnn() {
+template <class Config>
+void Chip8Machine<Config>::JUMP_1nnn() {
     uint16_t newAddress = opcode & 0x0FFFu; //Smart way of getting specific bit substrings you want to check out of an integer
     programCounter = newAddress;
 }
 
 //Jumps to new address, adding to stack to be able to refer back to original line
-void Chip8::CALL_2nnn() {
+//Like returns, calls nested more than 16 deep wrap around instead of writing past the stack
+template <class Config>
+void Chip8Machine<Config>::CALL_2nnn() {
     stack[stackPointer] = programCounter;
-    ++stackPointer;
+    stackPointer = (stackPointer + 1) & 0x0Fu;
 
     uint16_t newAddress = opcode & 0x0FFFu;
     programCounter = newAddress;
 }
 
 //Skips next instruction if value in xth register is equal to value of "kk"
-void Chip8::SE_3xkk() {
+template <class Config>
+void Chip8Machine<Config>::SE_3xkk() {
     uint8_t x = (opcode & 0x0F00u) >> 8u;
     uint8_t kk = opcode & 0x00FF;
 
     if (registers[x] == kk) {
-        programCounter += 2;
+        skipNextInstruction();
     }
 }
 
 //Skips next instruction if value in xth register is NOT equal to value of "kk"
-void Chip8::SNE_4xkk() {
+template <class Config>
+void Chip8Machine<Config>::SNE_4xkk() {
     uint8_t x = (opcode & 0x0F00u) >> 8u;
     uint8_t kk = opcode & 0x00FF;
 
     if (registers[x] != kk) {
-        programCounter += 2;
+        skipNextInstruction();
     }
 }
 
 //Skips next instruction if value in xth register is equal to value in yth register
-void Chip8::SE_5xy0() {
+template <class Config>
+void Chip8Machine<Config>::SE_5xy0() {
     uint8_t x = (opcode & 0x0F00u) >> 8u;
     uint8_t y = (opcode & 0x00F0u) >> 4u;
 
     if (registers[x] == registers[y]) {
-        programCounter += 2;
+        skipNextInstruction();
+    }
+}
+
+//Stores values from xth to yth registers in memory starting from index register, in either order (XO-CHIP)
+template <class Config>
+void Chip8Machine<Config>::SAVE_5xy2() {
+    uint8_t x = (opcode & 0x0F00u) >> 8u;
+    uint8_t y = (opcode & 0x00F0u) >> 4u;
+
+    int step = (x <= y) ? 1 : -1;
+    unsigned int count = (x <= y) ? (y - x) : (x - y);
+
+    if (Hooks::ENABLED) {
+        hookMemoryWrite(indexRegister, count + 1);
+    }
+
+    for (unsigned int i = 0; i <= count; ++i) {
+        writeMemory(indexRegister + i, registers[x + step * int(i)]);
+    }
+}
+
+//Loads values from memory starting from index register into xth to yth registers, in either order (XO-CHIP)
+template <class Config>
+void Chip8Machine<Config>::LOAD_5xy3() {
+    uint8_t x = (opcode & 0x0F00u) >> 8u;
+    uint8_t y = (opcode & 0x00F0u) >> 4u;
+
+    int step = (x <= y) ? 1 : -1;
+    unsigned int count = (x <= y) ? (y - x) : (x - y);
+
+    if (Hooks::ENABLED) {
+        hookMemoryRead(indexRegister, count + 1);
+    }
+
+    for (unsigned int i = 0; i <= count; ++i) {
+        registers[x + step * int(i)] = memory[(indexRegister + i) & (MEMORY_SIZE - 1)];
     }
 }
 
 //Sets value at xth register to kk
-void Chip8::LD_6xkk() {
+template <class Config>
+void Chip8Machine<Config>::LD_6xkk() {
     uint8_t x = (opcode & 0x0F00u) >> 8u;
     uint8_t kk = opcode & 0x00FF;
 
@@ -258,7 +500,8 @@ void Chip8::LD_6xkk() {
 }
 
 //Adds kk to value at xth register
-void Chip8::ADD_7xkk() {
+template <class Config>
+void Chip8Machine<Config>::ADD_7xkk() {
     uint8_t x = (opcode & 0x0F00u) >> 8u;
     uint8_t kk = opcode & 0x00FF;
 
@@ -266,7 +509,8 @@ void Chip8::ADD_7xkk() {
 }
 
 //Sets value at xth register to value at yth register
-void Chip8::LD_8xy0() {
+template <class Config>
+void Chip8Machine<Config>::LD_8xy0() {
     uint8_t x = (opcode & 0x0F00u) >> 8u;
     uint8_t y = (opcode & 0x00F0u) >> 4u;
 
@@ -274,7 +518,8 @@ void Chip8::LD_8xy0() {
 }
 
 //Sets value at xth register to bitwise OR between xth register and yth register values
-void Chip8::OR_8xy1() {
+template <class Config>
+void Chip8Machine<Config>::OR_8xy1() {
     uint8_t x = (opcode & 0x0F00u) >> 8u;
     uint8_t y = (opcode & 0x00F0u) >> 4u;
 
@@ -282,7 +527,8 @@ void Chip8::OR_8xy1() {
 }
 
 //Sets value at xth register to bitwise AND between xth register and yth register values
-void Chip8::AND_8xy2() {
+template <class Config>
+void Chip8Machine<Config>::AND_8xy2() {
     uint8_t x = (opcode & 0x0F00u) >> 8u;
     uint8_t y = (opcode & 0x00F0u) >> 4u;
 
@@ -290,23 +536,25 @@ void Chip8::AND_8xy2() {
 }
 
 //Sets value at xth register to bitwise XOR between xth register and yth register values
-void Chip8::XOR_8xy3() {
+template <class Config>
+void Chip8Machine<Config>::XOR_8xy3() {
     uint8_t x = (opcode & 0x0F00u) >> 8u;
     uint8_t y = (opcode & 0x00F0u) >> 4u;
 
-    registers[x] &= registers[y];
+    registers[x] ^= registers[y];
 }
 
 //Adds value at yth register to xth register, marking overflow register as 1 if the value 
 //overflows (is greater than 8 bits)
-void Chip8::ADD_8xy4() {
+template <class Config>
+void Chip8Machine<Config>::ADD_8xy4() {
     uint8_t x = (opcode & 0x0F00u) >> 8u;
     uint8_t y = (opcode & 0x00F0u) >> 4u;
 
     uint8_t valX = registers[x];
     uint8_t valY = registers[y];
 
-    uint8_t sum = valX + valY;
+    uint16_t sum = valX + valY;
     registers[x] = sum & 0x00FFu;
 
     if (sum > 0x00FFu) {
@@ -319,7 +567,8 @@ void Chip8::ADD_8xy4() {
 
 //Subtracts value at yth register from xth register, marking overflow register as 1 if the value
 //does NOT borrow (is NOT negative or 0)
-void Chip8::SUB_8xy5() {
+template <class Config>
+void Chip8Machine<Config>::SUB_8xy5() {
     uint8_t x = (opcode & 0x0F00u) >> 8u;
     uint8_t y = (opcode & 0x00F0u) >> 4u;
 
@@ -340,7 +589,8 @@ void Chip8::SUB_8xy5() {
 //Divides value at xth register by 2 and sets overflow register to 1 if there is a decimal
 //at the end (last digit before division is 1). Shifting bits to the right is equivalent to
 //division by 2
-void Chip8::SHR_8xy6() {
+template <class Config>
+void Chip8Machine<Config>::SHR_8xy6() {
     uint8_t x = (opcode & 0x0F00u) >> 8u;
     uint8_t valX = registers[x];
 
@@ -351,7 +601,8 @@ void Chip8::SHR_8xy6() {
 
 //Subtracts value at xth register from yth register and sets it in xth register,
 //marking overflow register as 1 if the value does NOT borrow (is NOT negative or 0)
-void Chip8::SUBN_8xy7() {
+template <class Config>
+void Chip8Machine<Config>::SUBN_8xy7() {
     uint8_t x = (opcode & 0x0F00u) >> 8u;
     uint8_t y = (opcode & 0x00F0u) >> 4u;
 
@@ -372,7 +623,8 @@ void Chip8::SUBN_8xy7() {
 //Multiplies value at xth register by 2 and sets overflow register to 1 if there is an
 //overflow (first digit before multiplication is 1). Shifting bits to the left is equivalent to
 //multiplication by 2
-void Chip8::SHL_8xyE() {
+template <class Config>
+void Chip8Machine<Config>::SHL_8xyE() {
     uint8_t x = (opcode & 0x0F00u) >> 8u;
     uint8_t valX = registers[x];
 
@@ -382,7 +634,8 @@ void Chip8::SHL_8xyE() {
 }
 
 //Skips next instruction if value at xth register and yth registers are NOT equal
-void Chip8::SNE_9xy0() {
+template <class Config>
+void Chip8Machine<Config>::SNE_9xy0() {
     uint8_t x = (opcode & 0x0F00u) >> 8u;
     uint8_t y = (opcode & 0x00F0u) >> 4u;
 
@@ -390,99 +643,179 @@ void Chip8::SNE_9xy0() {
     uint8_t valY = registers[y];
 
     if (valX != valY) {
-        programCounter += 2;
+        skipNextInstruction();
     }
 }
 
 //Sets value of index register equal to given address nnn
-void Chip8::LD_Annn() {
+template <class Config>
+void Chip8Machine<Config>::LD_Annn() {
     uint16_t address = opcode & 0x0FFFu;
     indexRegister = address;
 }
 
 //Jumps to address nnn + value at 1st register
-void Chip8::JP_Bnnn() {
+template <class Config>
+void Chip8Machine<Config>::JP_Bnnn() {
     uint16_t address = opcode & 0x0FFFu;
     programCounter = address + registers[0];
 }
 
 //Sets xth register to bitwise AND of random number and kk
-void Chip8::RND_Cxkk() {
+template <class Config>
+void Chip8Machine<Config>::RND_Cxkk() {
     uint8_t x = (opcode & 0x0F00u) >> 8u;
     uint8_t kk = opcode & 0x00FFu;
 
-    registers[x] = randByte(randGen) & kk;
+    registers[x] = randomByte() & kk;
 }
 
 //Draws sprite given by memory location saved in index register
 //Draws this sprite at position (x, y) in display, using register x and y
-//Then sets overflow register to 1 if sprite has collided with another sprite
+//Then sets overflow register to 1 if sprite has collided with another sprite, 0 otherwise
 //We know the sprite's width will be 8 pixels, but not height, which is what n stands for
-void Chip8::DRW_Dxyn() {
+//On SUPER-CHIP, n = 0 draws a 16x16 sprite instead, stored as 2 bytes per row
+//On XO-CHIP, the sprite is drawn once per selected plane, each plane's sprite following the last in memory
+template <class Config>
+void Chip8Machine<Config>::DRW_Dxyn() {
     uint8_t x = (opcode & 0x0F00u) >> 8u;
     uint8_t y = (opcode & 0x00F0u) >> 4u;
-    uint8_t height = (opcode & 0x000Fu);
+    unsigned int height = (opcode & 0x000Fu);
+    unsigned int width = 8;
 
-    uint8_t xDisplay = registers[x] % 64; //Can overflow beyond screen size so we wrap around
-    uint8_t yDisplay = registers[y] % 32;
+    if (SUPER && height == 0) {
+        height = 16;
+        width = 16;
+    }
+
+    unsigned int scale = displayScale();
+    unsigned int logicalWidth = VIDEO_WIDTH / scale;
+    unsigned int logicalHeight = VIDEO_HEIGHT / scale;
+
+    unsigned int xDisplay = registers[x] % logicalWidth; //Can overflow beyond screen size so we wrap around
+    unsigned int yDisplay = registers[y] % logicalHeight;
 
-    for (unsigned int i = 0; i < height; ++i) {
+    uint16_t address = indexRegister;
+    bool collided = false;
 
-        uint8_t spriteRow = memory[indexRegister + i];
+    for (unsigned int plane = 0; plane < PLANES; ++plane) {
+
+        if (!(planeMask & (1u << plane))) {
+            continue;
+        }
 
-        for (unsigned int j = 0; j < 8; ++j) {
+        uint64_t* planeDisplay = &display[plane * VIDEO_HEIGHT * DISPLAY_WORDS];
 
-            uint8_t spritePixel = (spriteRow >> j) & 0x01u;
-            uint32_t* screenPixel = &display[(xDisplay + i) * 32 + (yDisplay + j)]; //I was confused by this line at first. This method is probably marginally more efficient than just referencing the value in the array again and again?
+        //Rows past the bottom of the screen are clipped rather than wrapped
+        for (unsigned int i = 0; i < height && yDisplay + i < logicalHeight; ++i) {
 
-            if (spritePixel) {
+            uint64_t spriteRow = memory[(address + i * (width / 8)) & (MEMORY_SIZE - 1)];
 
-                if (*screenPixel == 0xFFFFFFFF) {
-                    registers[sizeof(registers) - 1] = 1;
+            if (width == 16) {
+                spriteRow = (spriteRow << 8) | memory[(address + i * 2 + 1) & (MEMORY_SIZE - 1)];
+            }
+
+            uint64_t rowBits = spriteRow;
+            unsigned int rowWidth = width;
+
+            //In low resolution on a bigger display, every sprite pixel becomes 2 display pixels wide
+            if (scale == 2) {
+                rowBits = 0;
+
+                for (unsigned int j = 0; j < width; ++j) {
+                    rowBits |= ((spriteRow >> j) & 0x01u) * 0x03u << (2 * j);
                 }
 
-                *screenPixel ^= 0xFFFFFFFF;
+                rowWidth = width * 2;
+            }
 
+            for (unsigned int s = 0; s < scale; ++s) {
+                uint64_t* row = &planeDisplay[((yDisplay + i) * scale + s) * DISPLAY_WORDS];
+                collided |= drawRow(row, xDisplay * scale, rowBits, rowWidth);
             }
 
         }
 
+        if (Hooks::ENABLED) {
+            hookMemoryRead(address, height * (width / 8)); //The sprite fetch, including rows clipped off the screen
+        }
+
+        address += height * (width / 8);
+
     }
+
+    registers[sizeof(registers) - 1] = collided ? 1 : 0;
 }
 
 //Skip next instruction if key with value at xth register is pressed
-void Chip8::SKP_Ex9E() {
+template <class Config>
+void Chip8Machine<Config>::SKP_Ex9E() {
     uint8_t x = (opcode & 0x0F00u) >> 8u;
 
-    uint8_t key = registers[x];
+    uint8_t key = registers[x] & 0x0Fu; //Only 16 keys, so bigger values wrap
 
     if (keys[key]) {
-        programCounter += 2;
+        skipNextInstruction();
     }
 }
 
 //Skip next instruction if key with value at xth register is NOT pressed
-void Chip8::SKNP_ExA1() {
+template <class Config>
+void Chip8Machine<Config>::SKNP_ExA1() {
     uint8_t x = (opcode & 0x0F00u) >> 8u;
 
-    uint8_t key = registers[x];
+    uint8_t key = registers[x] & 0x0Fu; //Only 16 keys, so bigger values wrap
 
     if (!keys[key]) {
-        programCounter += 2;
+        skipNextInstruction();
+    }
+}
+
+//Sets index register to the 16 bit address nnnn stored in the next 2 bytes, skipping over them (XO-CHIP)
+template <class Config>
+void Chip8Machine<Config>::LD_F000() {
+    indexRegister = (memory[programCounter & (MEMORY_SIZE - 1)] << 8u) | memory[(programCounter + 1) & (MEMORY_SIZE - 1)];
+    programCounter += 2;
+}
+
+//Selects the planes n that drawing, clearing and scrolling act on (XO-CHIP)
+template <class Config>
+void Chip8Machine<Config>::PLANE_Fn01() {
+    uint8_t n = (opcode & 0x0F00u) >> 8u;
+
+    planeMask = n & ((1u << PLANES) - 1);
+}
+
+//Loads the 16 byte audio pattern starting from index register (XO-CHIP)
+template <class Config>
+void Chip8Machine<Config>::AUDIO_F002() {
+    if (Hooks::ENABLED) {
+        hookMemoryRead(indexRegister, sizeof(audioPattern));
+    }
+
+    for (unsigned int i = 0; i < sizeof(audioPattern); ++i) {
+        audioPattern[i] = memory[(indexRegister + i) & (MEMORY_SIZE - 1)];
     }
 }
 
 //Set xth register to the value of the delay timer
-void Chip8::LD_Fx07() {
+template <class Config>
+void Chip8Machine<Config>::LD_Fx07() {
     uint8_t x = (opcode & 0x0F00u) >> 8u;
 
     registers[x] = delayTimer;
+
+    //A ROM reading a running timer is usually spinning until it runs out
+    if (delayTimer > 0) {
+        waitReason = Wait::TIMER;
+    }
 }
 
 //Wait until a key is pressed, then store the key value in the xth register
 //We do a "wait" by repeatedly moving the program counter back 2, which keeps it on the
 //same instruction
-void Chip8::LD_Fx0A() {
+template <class Config>
+void Chip8Machine<Config>::LD_Fx0A() {
     uint8_t x = (opcode & 0x0F00u) >> 8u;
 
     for (int i = 0; i < sizeof(keys); ++i) { //Not sure if more efficient than simple if else statements but was a lot easier to write
@@ -493,71 +826,489 @@ void Chip8::LD_Fx0A() {
     }
 
     programCounter -= 2;
+    waitReason = Wait::KEY;
 }
 
 //Set delay timer to the value of the xth register
-void Chip8::LD_Fx15() {
+template <class Config>
+void Chip8Machine<Config>::LD_Fx15() {
     uint8_t x = (opcode & 0x0F00u) >> 8u;
 
     delayTimer = registers[x];
 }
 
 //Set sound timer to the value of the xth register
-void Chip8::LD_Fx18() {
+template <class Config>
+void Chip8Machine<Config>::LD_Fx18() {
     uint8_t x = (opcode & 0x0F00u) >> 8u;
 
     soundTimer = registers[x];
 }
 
 //Add xth register value to index register
-void Chip8::ADD_Fx1E() {
+template <class Config>
+void Chip8Machine<Config>::ADD_Fx1E() {
     uint8_t x = (opcode & 0x0F00u) >> 8u;
 
     indexRegister += registers[x];
 }
 
 //Set index register to location of ith font sprite, i being value from xth register
-void Chip8::LD_Fx29() {
+template <class Config>
+void Chip8Machine<Config>::LD_Fx29() {
+    uint8_t x = (opcode & 0x0F00u) >> 8u;
+
+    indexRegister = FONT_ADDRESS + 5 * (registers[x] & 0x0Fu); //The address of the sprite in memory, not a byte of the font itself
+}
+
+//Set index register to location of ith big font sprite, i being value from xth register (SUPER-CHIP)
+template <class Config>
+void Chip8Machine<Config>::LD_Fx30() {
     uint8_t x = (opcode & 0x0F00u) >> 8u;
 
-    indexRegister = FONTSET[FONT_ADDRESS + 5 * registers[x]];
+    indexRegister = BIG_FONT_ADDRESS + 10 * (registers[x] & 0x0Fu);
 }
 
 //Stores BCD (binary coded decimal) value of xth register in index register, index + 1, index + 2
 //index register = hundreds digit, index + 1 = tens digit, index + 2 = ones digit
-void Chip8::LD_Fx33() {
+template <class Config>
+void Chip8Machine<Config>::LD_Fx33() {
     uint8_t x = (opcode & 0x0F00u) >> 8u;
     uint8_t value = registers[x];
 
-    memory[indexRegister + 2] = value % 10;
+    if (Hooks::ENABLED) {
+        hookMemoryWrite(indexRegister, 3);
+    }
+
+    writeMemory(indexRegister + 2, value % 10);
     value /= 10;
 
-    memory[indexRegister + 1] = value % 10;
+    writeMemory(indexRegister + 1, value % 10);
     value /= 10;
 
-    memory[indexRegister] = value % 10;
+    writeMemory(indexRegister, value % 10);
+}
+
+//Set the audio pattern playback pitch to the value of the xth register (XO-CHIP)
+template <class Config>
+void Chip8Machine<Config>::PITCH_Fx3A() {
+    uint8_t x = (opcode & 0x0F00u) >> 8u;
+
+    pitch = registers[x];
 }
 
 //Store values from 0th to xth registers in memory starting from index register
-void Chip8::LD_Fx55() {
+template <class Config>
+void Chip8Machine<Config>::LD_Fx55() {
     uint8_t x = (opcode & 0x0F00u) >> 8u;
 
+    if (Hooks::ENABLED) {
+        hookMemoryWrite(indexRegister, x + 1);
+    }
+
     for (uint8_t i = 0; i <= x; ++i) {
-        memory[indexRegister + i] = registers[i];
+        writeMemory(indexRegister + i, registers[i]);
     }
 }
 
 //Read values from 0th to xth registers in memory starting from index register, and store in registers
-void Chip8::LD_Fx65() {
+template <class Config>
+void Chip8Machine<Config>::LD_Fx65() {
     uint8_t x = (opcode & 0x0F00u) >> 8u;
 
+    if (Hooks::ENABLED) {
+        hookMemoryRead(indexRegister, x + 1);
+    }
+
     for (uint8_t i = 0; i <= x; ++i) {
-        registers[i] = memory[indexRegister + i];
+        registers[i] = memory[(indexRegister + i) & (MEMORY_SIZE - 1)];
+    }
+}
+
+//Store values from 0th to xth registers in the user flags (SUPER-CHIP)
+template <class Config>
+void Chip8Machine<Config>::LD_Fx75() {
+    uint8_t x = (opcode & 0x0F00u) >> 8u;
+
+    for (uint8_t i = 0; i <= x; ++i) {
+        flagRegisters[i] = registers[i];
+    }
+}
+
+//Read values from 0th to xth user flags and store in registers (SUPER-CHIP)
+template <class Config>
+void Chip8Machine<Config>::LD_Fx85() {
+    uint8_t x = (opcode & 0x0F00u) >> 8u;
+
+    for (uint8_t i = 0; i <= x; ++i) {
+        registers[i] = flagRegisters[i];
     }
 }
 
 //Null function used for invalid opcodes
-void Chip8::OP_NULL() {}
+template <class Config>
+void Chip8Machine<Config>::OP_NULL() {}
+
+
+
+
+
+
+
+
+
+//Display helpers
+
+
+//Skips over the next instruction, which on XO-CHIP may be the 4 byte long F000 nnnn
+template <class Config>
+void Chip8Machine<Config>::skipNextInstruction() {
+    if (XO && memory[programCounter & (MEMORY_SIZE - 1)] == 0xF0 && memory[(programCounter + 1) & (MEMORY_SIZE - 1)] == 0x00) {
+        programCounter += 4;
+    }
+    else {
+        programCounter += 2;
+    }
+}
+
+//In low resolution on a SUPER-CHIP sized display, every pixel is drawn as a 2x2 block
+template <class Config>
+unsigned int Chip8Machine<Config>::displayScale() const {
+    if (SUPER && !highResolution) {
+        return 2;
+    }
+
+    return 1;
+}
+
+//XORs the lowest "width" bits of a sprite row into a display row starting at pixel xPos
+//The row lines up with at most 2 display words, and anything past the right edge is clipped
+template <class Config>
+bool Chip8Machine<Config>::drawRow(uint64_t* row, unsigned int xPos, uint64_t bits, unsigned int width) {
+    unsigned int word = xPos / 64;
+    unsigned int offset = xPos % 64;
+
+    uint64_t aligned = bits << (64 - width); //Moves the leftmost sprite pixel into the highest bit
+    uint64_t firstBits = aligned >> offset;
+
+    unsigned int index = (row - display) + word;
+
+    bool collided = (row[word] & firstBits) != 0;
+    writeDisplay(index, row[word] ^ firstBits);
+
+    if (offset + width > 64 && word + 1 < DISPLAY_WORDS) {
+        uint64_t secondBits = aligned << (64 - offset);
+
+        collided |= (row[word + 1] & secondBits) != 0;
+        writeDisplay(index + 1, row[word + 1] ^ secondBits);
+    }
+
+    return collided;
+}
+
+//Scrolls the selected planes by whole rows, which is just moving the words of each row
+template <class Config>
+void Chip8Machine<Config>::scrollRows(int rows) {
+    unsigned int amount = (rows < 0 ? -rows : rows) * displayScale();
+
+    if (amount > VIDEO_HEIGHT) {
+        amount = VIDEO_HEIGHT;
+    }
+
+    unsigned int keptWords = (VIDEO_HEIGHT - amount) * DISPLAY_WORDS;
+    unsigned int clearedWords = amount * DISPLAY_WORDS;
+
+    for (unsigned int plane = 0; plane < PLANES; ++plane) {
+
+        if (!(planeMask & (1u << plane))) {
+            continue;
+        }
+
+        unsigned int first = plane * VIDEO_HEIGHT * DISPLAY_WORDS;
+        uint64_t* planeDisplay = &display[first];
+
+        //Every word of the plane may move, so the plane is taken out of the hash and added back after
+        if (Config::STATE_HASH) {
+            contentHash ^= hashDisplay(first, VIDEO_HEIGHT * DISPLAY_WORDS);
+        }
+
+        if (rows > 0) {
+            memmove(planeDisplay + clearedWords, planeDisplay, keptWords * sizeof(uint64_t));
+            memset(planeDisplay, 0, clearedWords * sizeof(uint64_t));
+        }
+        else {
+            memmove(planeDisplay, planeDisplay + clearedWords, keptWords * sizeof(uint64_t));
+            memset(planeDisplay + keptWords, 0, clearedWords * sizeof(uint64_t));
+        }
+
+        if (Config::STATE_HASH) {
+            contentHash ^= hashDisplay(first, VIDEO_HEIGHT * DISPLAY_WORDS);
+        }
+
+    }
+}
+
+//Scrolls the selected planes sideways by shifting each row's words, carrying bits over from the neighbouring word
+template <class Config>
+void Chip8Machine<Config>::scrollColumns(int columns) {
+    unsigned int amount = (columns < 0 ? -columns : columns) * displayScale();
+
+    for (unsigned int plane = 0; plane < PLANES; ++plane) {
+
+        if (!(planeMask & (1u << plane))) {
+            continue;
+        }
+
+        unsigned int first = plane * VIDEO_HEIGHT * DISPLAY_WORDS;
+
+        if (Config::STATE_HASH) {
+            contentHash ^= hashDisplay(first, VIDEO_HEIGHT * DISPLAY_WORDS);
+        }
+
+        for (unsigned int y = 0; y < VIDEO_HEIGHT; ++y) {
+
+            uint64_t* row = &display[(plane * VIDEO_HEIGHT + y) * DISPLAY_WORDS];
+
+            if (columns > 0) {
+                for (unsigned int i = DISPLAY_WORDS; i-- > 0;) {
+                    row[i] = (row[i] >> amount) | (i > 0 ? row[i - 1] << (64 - amount) : 0);
+                }
+            }
+            else {
+                for (unsigned int i = 0; i < DISPLAY_WORDS; ++i) {
+                    row[i] = (row[i] << amount) | (i + 1 < DISPLAY_WORDS ? row[i + 1] >> (64 - amount) : 0);
+                }
+            }
+
+        }
+
+        if (Config::STATE_HASH) {
+            contentHash ^= hashDisplay(first, VIDEO_HEIGHT * DISPLAY_WORDS);
+        }
+
+    }
+}
+
+//Expands the bit packed display into one RGBA8888 value per pixel for the platform to draw
+template <class Config>
+void Chip8Machine<Config>::renderPixels(uint32_t* pixels) const {
+    for (unsigned int y = 0; y < VIDEO_HEIGHT; ++y) {
+        for (unsigned int x = 0; x < VIDEO_WIDTH; ++x) {
+
+            unsigned int color = 0;
+
+            for (unsigned int plane = 0; plane < PLANES; ++plane) {
+                uint64_t word = display[(plane * VIDEO_HEIGHT + y) * DISPLAY_WORDS + x / 64];
+                color |= ((word >> (63 - x % 64)) & 0x01u) << plane;
+            }
+
+            pixels[y * VIDEO_WIDTH + x] = PIXEL_COLORS[color];
+
+        }
+    }
+}
+
+
+
+
+
+
+
+
+
+//State hashing
+
+
+//The state hash is the XOR of a hash of every (location, value) pair, like a Zobrist hash. Writes
+//only need to XOR out the old value's hash and XOR in the new one, and a location holding 0
+//hashes to 0, so cleared memory and display cost nothing
+static uint64_t hashLocation(uint64_t location, uint64_t value) {
+    if (value == 0) {
+        return 0;
+    }
+
+    //splitmix64 finalizer, which spreads every input bit over the whole result
+    uint64_t z = value ^ (location * 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+//Memory bytes and display words get separate location ranges so they never hash alike
+const uint64_t DISPLAY_LOCATIONS = 1ull << 32;
+const uint64_t STATE_LOCATIONS = 1ull << 33;
+
+//Writes a byte of memory, keeping the state hash up to date
+template <class Config>
+void Chip8Machine<Config>::writeMemory(uint16_t address, uint8_t value) {
+    address &= MEMORY_SIZE - 1;
+
+    if (Config::STATE_HASH) {
+        contentHash ^= hashLocation(address, memory[address]) ^ hashLocation(address, value);
+    }
+    memory[address] = value;
+}
+
+//Writes a word of the display, keeping the state hash up to date
+template <class Config>
+void Chip8Machine<Config>::writeDisplay(unsigned int index, uint64_t value) {
+    if (Config::STATE_HASH) {
+        contentHash ^= hashLocation(DISPLAY_LOCATIONS + index, display[index]) ^ hashLocation(DISPLAY_LOCATIONS + index, value);
+    }
+    display[index] = value;
+}
+
+//Addresses wrap at the end of memory, so a range of bytes from the index register can land at the
+//start of memory. The hooks get the bytes really touched, as one range or two
+template <class Config>
+void Chip8Machine<Config>::hookMemoryRead(unsigned int address, unsigned int count) {
+    address &= MEMORY_SIZE - 1;
+    unsigned int untilEnd = std::min(count, MEMORY_SIZE - address);
+
+    hooks.memoryRead(address, untilEnd);
+
+    if (count > untilEnd) {
+        hooks.memoryRead(0, count - untilEnd);
+    }
+}
+
+template <class Config>
+void Chip8Machine<Config>::hookMemoryWrite(unsigned int address, unsigned int count) {
+    address &= MEMORY_SIZE - 1;
+    unsigned int untilEnd = std::min(count, MEMORY_SIZE - address);
+
+    hooks.memoryWrite(address, untilEnd);
+
+    if (count > untilEnd) {
+        hooks.memoryWrite(0, count - untilEnd);
+    }
+}
+
+//Hash of a range of memory, used to rebuild the hash from scratch
+template <class Config>
+uint64_t Chip8Machine<Config>::hashMemory(unsigned int first, unsigned int count) const {
+    uint64_t hash = 0;
+
+    for (unsigned int i = first; i < first + count; ++i) {
+        hash ^= hashLocation(i, memory[i]);
+    }
+
+    return hash;
+}
+
+//Hash of a range of display words, used for operations that move the whole display
+template <class Config>
+uint64_t Chip8Machine<Config>::hashDisplay(unsigned int first, unsigned int count) const {
+    uint64_t hash = 0;
+
+    for (unsigned int i = first; i < first + count; ++i) {
+        hash ^= hashLocation(DISPLAY_LOCATIONS + i, display[i]);
+    }
+
+    return hash;
+}
+
+//Hash of the whole machine state. Memory and display are hashed as they are written, while
+//the registers and other small state are cheaper to fold in here, once per frame, than on every
+//instruction that writes them. Machines built without the running hash work it all out here
+template <class Config>
+uint64_t Chip8Machine<Config>::stateHash() const {
+    uint64_t hash = Config::STATE_HASH ? contentHash : hashMemory(0, MEMORY_SIZE) ^ hashDisplay(0, PLANES * VIDEO_HEIGHT * DISPLAY_WORDS);
+
+    for (unsigned int i = 0; i < sizeof(registers); ++i) {
+        hash ^= hashLocation(STATE_LOCATIONS + i, registers[i]);
+    }
+    for (unsigned int i = 0; i < sizeof(stack) / sizeof(stack[0]); ++i) {
+        hash ^= hashLocation(STATE_LOCATIONS + 16 + i, stack[i]);
+    }
+
+    hash ^= hashLocation(STATE_LOCATIONS + 32, programCounter);
+    hash ^= hashLocation(STATE_LOCATIONS + 33, indexRegister);
+    hash ^= hashLocation(STATE_LOCATIONS + 34, stackPointer);
+    hash ^= hashLocation(STATE_LOCATIONS + 35, delayTimer);
+    hash ^= hashLocation(STATE_LOCATIONS + 36, soundTimer);
+    hash ^= hashLocation(STATE_LOCATIONS + 37, (highResolution ? 0x100u : 0) | planeMask);
+
+    return hash;
+}
+
+//Prints the machine state, for comparing two machines by eye
+template <class Config>
+void Chip8Machine<Config>::dumpState(std::ostream& out) const {
+    out << std::hex << std::uppercase << std::setfill('0');
+
+    out << "PC=" << std::setw(4) << programCounter << " I=" << std::setw(4) << indexRegister
+        << " SP=" << std::setw(2) << unsigned(stackPointer) << " DT=" << std::setw(2) << unsigned(delayTimer)
+        << " ST=" << std::setw(2) << unsigned(soundTimer) << " opcode=" << std::setw(4) << opcode << "\n";
+
+    out << "V:";
+    for (unsigned int i = 0; i < sizeof(registers); ++i) {
+        out << " " << std::setw(2) << unsigned(registers[i]);
+    }
+
+    out << "\nstack:";
+    for (unsigned int i = 0; i < sizeof(stack) / sizeof(stack[0]); ++i) {
+        out << " " << std::setw(4) << stack[i];
+    }
+
+    out << "\nhash=" << std::setw(16) << stateHash() << "\n";
+
+    out << std::dec << std::nouppercase << std::setfill(' ');
+}
+
+//Puts the machine back the way the constructor left it, without reseeding or losing debugger
+//settings. The machine is trivially copyable, so copying in one built once is a single memcpy
+template <class Config>
+void Chip8Machine<Config>::reset() {
+    static const Chip8Machine clean;
+
+    uint64_t random = randomState;
+    Hooks keptHooks = std::move(hooks);
+
+    *this = clean;
+
+    randomState = random;
+    hooks = std::move(keptHooks);
+}
+
+//Copies out the machine state, for saving or sending elsewhere
+template <class Config>
+typename Chip8Machine<Config>::Snapshot Chip8Machine<Config>::snapshot() const {
+    Snapshot state{};
+
+    memcpy(state.registers, registers, sizeof(registers));
+    memcpy(state.memory, memory, sizeof(memory));
+    memcpy(state.display, display, sizeof(display));
+    memcpy(state.stack, stack, sizeof(stack));
+    memcpy(state.keys, keys, sizeof(keys));
+
+    state.indexRegister = indexRegister;
+    state.programCounter = programCounter;
+    state.stackPointer = stackPointer;
+    state.delayTimer = delayTimer;
+    state.soundTimer = soundTimer;
+    state.highResolution = highResolution;
+    state.planeMask = planeMask;
+    state.halted = halted;
+
+    return state;
+}
+
+//Reseeds the random number generator, so two machines given the same seed make the same random numbers
+template <class Config>
+void Chip8Machine<Config>::seed(unsigned int value) {
+    randomState = value;
+}
+
+//Next random byte, from a splitmix64 generator. Its whole state is one word, which keeps the
+//machine trivially copyable
+template <class Config>
+uint8_t Chip8Machine<Config>::randomByte() {
+    uint64_t z = (randomState += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return static_cast<uint8_t>((z ^ (z >> 31)) >> 56);
+}
 
 
 
@@ -568,13 +1319,24 @@ void Chip8::OP_NULL() {}
 
 
 //Function that accomplishes everything that occurs within one cycle of the CHIP8 CPU
-void Chip8::Cycle() {
+template <class Config>
+void Chip8Machine<Config>::Cycle() {
+
+    if (halted) {
+        return;
+    }
+
+    //Debug builds can stop here, before the instruction runs. Production hooks compile away
+    if (Hooks::ENABLED && hooks.beforeInstruction(programCounter)) {
+        return;
+    }
 
-    opcode = (memory[programCounter] << 8u) | memory[programCounter + 1]; //Bitwise OR when the first byte is moved 8 spaces left just adds that byte to the next 8 spaces
+    opcode = (memory[programCounter & (MEMORY_SIZE - 1)] << 8u) | memory[(programCounter + 1) & (MEMORY_SIZE - 1)]; //Bitwise OR when the first byte is moved 8 spaces left just adds that byte to the next 8 spaces
 
     programCounter += 2;
+    waitReason = Wait::NONE;
 
-    ((*this).*(table[(opcode & 0xF000u) >> 12u]))();
+    ((*this).*(TABLES.table[(opcode & 0xF000u) >> 12u]))();
 
     if (delayTimer > 0) {
         --delayTimer;
@@ -583,4 +1345,40 @@ void Chip8::Cycle() {
         --soundTimer;
     }
 
-}
\ No newline at end of file
+    if (Hooks::ENABLED) {
+        hooks.afterInstruction(opcode, registers);
+    }
+
+}
+
+//Runs the cycles of one 60 Hz frame, for callers that step the machine without a platform
+template <class Config>
+void Chip8Machine<Config>::Frame() {
+    for (unsigned int i = 0; i < CYCLES_PER_FRAME; ++i) {
+        Cycle();
+    }
+
+    if (Hooks::ENABLED) {
+        hooks.endFrame();
+    }
+}
+
+
+
+
+//The machines that get compiled, since the template definitions live in this file
+template class Chip8Machine<Chip8Config>;
+template class Chip8Machine<SuperChip8Config>;
+template class Chip8Machine<XOChip8Config>;
+template class Chip8Machine<FuzzChip8Config>;
+template class Chip8Machine<DebugChip8Config>;
+template class Chip8Machine<DebugSuperChip8Config>;
+template class Chip8Machine<DebugXOChip8Config>;
+template class Chip8Machine<TraceChip8Config>;
+template class Chip8Machine<TraceSuperChip8Config>;
+template class Chip8Machine<TraceXOChip8Config>;
+
+//Machines without a debugger are plain data, so they can be copied with memcpy, kept in big arrays and reset cheaply
+static_assert(std::is_trivially_copyable<Chip8>::value, "Chip8 must stay trivially copyable");
+static_assert(std::is_trivially_copyable<SuperChip8>::value, "SuperChip8 must stay trivially copyable");
+static_assert(std::is_trivially_copyable<XOChip8>::value, "XOChip8 must stay trivially copyable");
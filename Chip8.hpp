@@ -1,35 +1,159 @@
 //Apparently you need header files to declare all the methods you will define for a class
 
+#pragma once
+
+#include <cstddef>
 #include <cstdint>
 #include <fstream>
 #include <chrono>
-#include <random>
+#include <iosfwd>
+
+//Hook policy for machines without a debugger. Every hook is an empty inline function, and the
+//calls are behind "if (Hooks::ENABLED)", so production machines pay nothing for them
+struct NoHooks {
+    static constexpr bool ENABLED = false;
+
+    bool beforeInstruction(uint16_t) { return false; }
+    void afterInstruction(uint16_t, uint8_t const*) {}
+    void memoryRead(uint16_t, unsigned int) {}
+    void memoryWrite(uint16_t, unsigned int) {}
+    void endFrame() {}
+};
+
+//Machine configurations. The display size, memory size and number of display planes are compile
+//time parameters, so the original CHIP8 build keeps its small layout while the SUPER-CHIP and
+//XO-CHIP builds get the bigger ones
+struct Chip8Config {
+    static constexpr unsigned int WIDTH = 64;
+    static constexpr unsigned int HEIGHT = 32;
+    static constexpr unsigned int MEMORY_SIZE = 4096;
+    static constexpr unsigned int PLANES = 1;
+    static constexpr bool STATE_HASH = true; //Keep the running hash behind stateHash() up to date on every write
+    typedef NoHooks Hooks;
+};
+
+struct SuperChip8Config {
+    static constexpr unsigned int WIDTH = 128;
+    static constexpr unsigned int HEIGHT = 64;
+    static constexpr unsigned int MEMORY_SIZE = 4096;
+    static constexpr unsigned int PLANES = 1;
+    static constexpr bool STATE_HASH = true;
+    typedef NoHooks Hooks;
+};
+
+struct XOChip8Config {
+    static constexpr unsigned int WIDTH = 128;
+    static constexpr unsigned int HEIGHT = 64;
+    static constexpr unsigned int MEMORY_SIZE = 65536;
+    static constexpr unsigned int PLANES = 2;
+    static constexpr bool STATE_HASH = true;
+    typedef NoHooks Hooks;
+};
+
+//The original machine without the running state hash, for the fuzzer, which never reads the hash
+//and reloads memory for every case. stateHash() still works, by hashing everything when called
+struct FuzzChip8Config : Chip8Config {
+    static constexpr bool STATE_HASH = false;
+};
+
+class StaticRuntime; //Runs code translated ahead of time by the Recompiler, see StaticRuntime.hpp
 
 //The Chip8 computer and its specifications
-class Chip8 {
+template <class Config>
+class Chip8Machine {
+
+    friend class StaticRuntime; //Translated code works directly on the machine state
 
     public:
-        Chip8();
+        static constexpr unsigned int VIDEO_WIDTH = Config::WIDTH;
+        static constexpr unsigned int VIDEO_HEIGHT = Config::HEIGHT;
+        static constexpr unsigned int MEMORY_SIZE = Config::MEMORY_SIZE;
+        static constexpr unsigned int PLANES = Config::PLANES;
+        static constexpr unsigned int DISPLAY_WORDS = VIDEO_WIDTH / 64; //Number of 64 bit words in one display row
+
+        static constexpr unsigned int CYCLES_PER_FRAME = 10; //Cycles run per 60 Hz frame when stepping without a platform, about 600 instructions a second
+
+        static constexpr bool SUPER = VIDEO_WIDTH > 64; //Enables the SUPER-CHIP opcodes (scrolling, 16x16 sprites, high resolution)
+        static constexpr bool XO = PLANES > 1; //Enables the XO-CHIP opcodes (planes, long index loads, register ranges)
+
+        typedef typename Config::Hooks Hooks;
+
+        static_assert(VIDEO_WIDTH % 64 == 0, "Display rows are stored as whole 64 bit words");
+        static_assert(VIDEO_WIDTH == 2 * VIDEO_HEIGHT, "Display must keep the 2:1 CHIP8 aspect ratio");
+        static_assert((MEMORY_SIZE & (MEMORY_SIZE - 1)) == 0, "Memory size must be a power of 2 so addresses can wrap with a mask");
+        static_assert(PLANES >= 1 && PLANES <= 2, "Only 1 or 2 display planes are supported");
+
+        //The machine state copied out by snapshot(), laid out so it can be sent as raw bytes
+        struct Snapshot {
+            uint8_t memory[MEMORY_SIZE];
+            uint64_t display[PLANES * VIDEO_HEIGHT * DISPLAY_WORDS];
+            uint16_t stack[16];
+            uint16_t indexRegister;
+            uint16_t programCounter;
+            uint8_t registers[16];
+            uint8_t keys[16];
+            uint8_t stackPointer;
+            uint8_t delayTimer;
+            uint8_t soundTimer;
+            uint8_t highResolution;
+            uint8_t planeMask;
+            uint8_t halted;
+        };
+
+        //What the last instruction was waiting on, for schedulers that want to run something else meanwhile
+        enum class Wait : uint8_t {
+            NONE,
+            KEY, //Fx0A found no key pressed and will repeat
+            TIMER //Fx07 read a delay timer that is still counting down
+        };
+
+        Chip8Machine();
         void loadROM(char const* fileName);
+        void loadROM(uint8_t const* data, size_t size);
         void Cycle();
+        void Frame(); //Runs CYCLES_PER_FRAME cycles
+        void reset(); //Back to a freshly constructed machine, much cheaper than constructing a new one
+        Snapshot snapshot() const;
+        Wait waiting() const { return waitReason; }
+        void renderPixels(uint32_t* pixels) const; //Expands the bit packed display into one RGBA8888 value per pixel
+
+        uint64_t stateHash() const; //Hash of the whole machine state, cheap enough to read every frame
+        void dumpState(std::ostream& out) const; //Prints the registers, timers, stack and hash
+        void seed(unsigned int value); //Reseeds the random number generator, for runs that need to repeat exactly
+        uint8_t readMemory(uint16_t address) const { return memory[address & (MEMORY_SIZE - 1)]; } //Wraps the address like the CPU does
+        uint16_t getProgramCounter() const { return programCounter; }
 
         uint8_t keys[16]{}; //The key to input mappings
-        
-        uint32_t display[64 * 32]{}; //Current pixel display values
+
+        uint64_t display[PLANES * VIDEO_HEIGHT * DISPLAY_WORDS]{}; //Bit packed pixel display, one row after another, with the leftmost pixel of a row in the highest bit of its first word
+
+        bool halted{}; //Set when the ROM exits through 00FD, after which cycles do nothing
+
+        Hooks hooks; //Debugger or trace hooks, see Debugger.hpp and Trace.hpp. Empty for production machines
 
     private:
         void Table0();
+        void Table5();
         void Table8();
         void TableE();
         void TableF();
 
         void CLS_00E0();
         void RET_00EE();
+        void SCD_00Cn();
+        void SCU_00Dn();
+        void SCR_00FB();
+        void SCL_00FC();
+        void EXIT_00FD();
+        void LOW_00FE();
+        void HIGH_00FF();
         void JUMP_1nnn();
         void CALL_2nnn();
         void SE_3xkk();
         void SNE_4xkk();
         void SE_5xy0();
+        void SAVE_5xy2();
+        void LOAD_5xy3();
         void LD_6xkk();
         void ADD_7xkk();
         void LD_8xy0();
@@ -48,19 +172,40 @@ class Chip8 {
         void DRW_Dxyn();
         void SKP_Ex9E();
         void SKNP_ExA1();
+        void LD_F000();
+        void PLANE_Fn01();
+        void AUDIO_F002();
         void LD_Fx07();
         void LD_Fx0A();
         void LD_Fx15();
         void LD_Fx18();
         void ADD_Fx1E();
         void LD_Fx29();
+        void LD_Fx30();
         void LD_Fx33();
+        void PITCH_Fx3A();
         void LD_Fx55();
         void LD_Fx65();
+        void LD_Fx75();
+        void LD_Fx85();
         void OP_NULL();
 
+        void skipNextInstruction(); //Skips over the next instruction, which is 4 bytes long for the XO-CHIP F000 nnnn
+        unsigned int displayScale() const; //Size in display pixels of one pixel in the current resolution
+        bool drawRow(uint64_t* row, unsigned int xPos, uint64_t bits, unsigned int width); //XORs a sprite row into a display row, returning if any pixel was turned off
+        void scrollRows(int rows); //Scrolls the selected planes down (positive) or up (negative)
+        void scrollColumns(int columns); //Scrolls the selected planes right (positive) or left (negative)
+
+        void writeMemory(uint16_t address, uint8_t value); //All memory and display writes go through these to keep the state hash up to date
+        void writeDisplay(unsigned int index, uint64_t value);
+        uint64_t hashMemory(unsigned int first, unsigned int count) const;
+        uint64_t hashDisplay(unsigned int first, unsigned int count) const;
+        void hookMemoryRead(unsigned int address, unsigned int count); //Reports accesses to the hooks at the bytes they really touch
+        void hookMemoryWrite(unsigned int address, unsigned int count);
+        uint8_t randomByte();
+
         uint8_t registers[16]{}; //The registers with which the CPU will perform its operations
-        uint8_t memory[4096]{}; //4kb of memory for the computer
+        uint8_t memory[MEMORY_SIZE]{}; //4kb of memory for the computer (64kb for XO-CHIP)
         uint16_t indexRegister{}; //The register for memory space addresses for operations performed by the CPU
         uint16_t programCounter{}; //The register for the ADDRESS of the next instruction
 
@@ -70,18 +215,40 @@ class Chip8 {
         uint8_t delayTimer{}; //The timer (60 Hz)
         uint8_t soundTimer{}; //The timer for playing sound, which will turn off on next cycle unless kept on (60 Hz)
 
-        uint16_t opcode; //The actual instruction we are currently looking at
+        uint16_t opcode{}; //The actual instruction we are currently looking at
+
+        bool highResolution{}; //SUPER-CHIP high resolution mode, otherwise every pixel is drawn as a 2x2 block
+        uint8_t planeMask{1}; //XO-CHIP planes that drawing, clearing and scrolling act on
+        uint8_t flagRegisters[16]{}; //SUPER-CHIP "RPL user flags" saved and loaded by Fx75 and Fx85
+        uint8_t audioPattern[16]{}; //XO-CHIP audio pattern buffer loaded by F002
+        uint8_t pitch{64}; //XO-CHIP audio pattern playback pitch
+
+        uint64_t contentHash{}; //Running hash of memory and display, updated on every write
+
+        Wait waitReason{}; //Set by the last instruction if it was waiting on a key or timer
+
+
+        uint64_t randomState; //Random number generator state, seeded by the clock
+
 
+        typedef void (Chip8Machine::*Chip8Func)(); //Easy to read way of making function pointers. Chip8Func is a function pointer, and we are making tables of this. This typedef command specifies that this itself is a pointer to a void function, which will be dereferenced upon conversion. Can use this command to create your own type names for readability.
 
-        std::default_random_engine randGen; //Random number generator seeded by the clock
-        std::uniform_int_distribution<unsigned int> randByte; //Uniform distribution of integer range
+        //The opcode tables, shared by every machine of this type rather than stored in each one
+        struct OpcodeTables {
+            Chip8Func table[0xF + 1];
+            Chip8Func table0[0xFF + 1];
+            Chip8Func table5[0xF + 1];
+            Chip8Func table8[0xF + 1];
+            Chip8Func tableE[0xF + 1];
+            Chip8Func tableF[0xFF + 1];
+        };
 
+        static constexpr OpcodeTables buildTables();
+        static const OpcodeTables TABLES; //Defined constexpr in Chip8.cpp, once the opcode functions are declared
 
-        typedef void (Chip8::*Chip8Func)(); //Easy to read way of making function pointers. Chip8Func is a function pointer, and we are making tables of this. This typedef command specifies that this itself is a pointer to a void function, which will be dereferenced upon conversion. Can use this command to create your own type names for readability.
-        Chip8Func table[0xF + 1];
-        Chip8Func table0[0xE + 1];
-        Chip8Func table8[0xE + 1];
-        Chip8Func tableE[0xE + 1];
-        Chip8Func tableF[0x65 + 1];
+};
 
-};
\ No newline at end of file
+typedef Chip8Machine<Chip8Config> Chip8; //The original 64x32 machine with 4kb of memory
+typedef Chip8Machine<SuperChip8Config> SuperChip8; //SUPER-CHIP, 128x64 with scrolling and 16x16 sprites
+typedef Chip8Machine<XOChip8Config> XOChip8; //XO-CHIP, SUPER-CHIP plus 2 display planes and 64kb of memory
+typedef Chip8Machine<FuzzChip8Config> FuzzChip8; //Chip8 without the running state hash
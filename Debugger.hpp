@@ -0,0 +1,302 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "Chip8.hpp"
+
+//Debugger hooks for Chip8 machines
+//
+//DebugHooks is a hook policy (see NoHooks in Chip8.hpp) which gives a machine PC breakpoints,
+//read and write watchpoints on memory ranges, register conditions and instruction stepping. Only
+//the DebugChip8 machines below are built with it, the normal ones compile the hooks away.
+//
+//Checks are only paid for when something is set: breakpoints are one bit per address,
+//watchpoints are first looked up in a bitmap of 256 byte pages and only ranges on a marked page
+//are compared, and registers are only looked at while there are register conditions.
+//
+//A machine that has stopped does nothing on Cycle() or Frame() until resume() or step() is
+//called. Breakpoints stop before the instruction runs, everything else stops after it
+class DebugHooks {
+
+    public:
+        static constexpr bool ENABLED = true;
+
+        enum class Stop : uint8_t {
+            NONE,
+            BREAKPOINT, //The instruction at a breakpoint is about to run
+            READ, //An instruction read watched memory
+            WRITE, //An instruction wrote watched memory
+            REGISTER, //A register condition became true
+            STEP //The instructions asked for by step() have run
+        };
+
+        enum class Condition : uint8_t {
+            CHANGED, //The register changed
+            EQUALS //The register changed to the value
+        };
+
+        void addBreakpoint(uint16_t address);
+        void removeBreakpoint(uint16_t address);
+
+        void addWatchpoint(uint16_t address, unsigned int length, bool read, bool write);
+        void removeWatchpoint(uint16_t address); //Removes every watchpoint starting at address
+
+        void addCondition(uint8_t reg, Condition condition, uint8_t value = 0);
+        void removeConditions(uint8_t reg);
+
+        void clear(); //Removes all of the above
+
+        void resume(); //Carries on until something else stops the machine
+        void step(unsigned int instructions); //Resumes and stops again once this many instructions have run
+
+        bool stopped() const { return stopReason != Stop::NONE; }
+        Stop reason() const { return stopReason; }
+        uint16_t where() const { return stopAddress; } //The breakpoint address, or the first watched byte that was touched
+        uint8_t stoppedRegister() const { return stopRegister; }
+
+        //Called by the machine
+        bool beforeInstruction(uint16_t programCounter) {
+            if (stopReason != Stop::NONE) {
+                return true;
+            }
+
+            if (skipBreakpoint) {
+                skipBreakpoint = false; //Resuming from a breakpoint runs its instruction once
+            }
+            else if ((breakpoints[programCounter >> 6u] >> (programCounter & 63u)) & 1u) {
+                stopReason = Stop::BREAKPOINT;
+                stopAddress = programCounter;
+                return true;
+            }
+
+            return false;
+        }
+
+        void afterInstruction(uint16_t, uint8_t const* registers) {
+            if (!conditions.empty()) {
+                checkConditions(registers);
+            }
+
+            if (stepsLeft > 0 && --stepsLeft == 0 && stopReason == Stop::NONE) {
+                stopReason = Stop::STEP;
+            }
+        }
+
+        void memoryRead(uint16_t address, unsigned int length) {
+            if (onPage(readPages, address, length)) {
+                checkWatchpoints(address, length, Stop::READ);
+            }
+        }
+
+        void memoryWrite(uint16_t address, unsigned int length) {
+            if (onPage(writePages, address, length)) {
+                checkWatchpoints(address, length, Stop::WRITE);
+            }
+        }
+
+        void endFrame() {}
+
+    private:
+        static constexpr unsigned int PAGE_SHIFT = 8;
+        static constexpr unsigned int PAGES = 65536 >> PAGE_SHIFT;
+
+        struct Watchpoint {
+            uint16_t address;
+            unsigned int length;
+            bool read;
+            bool write;
+        };
+
+        struct RegisterCondition {
+            uint8_t reg;
+            Condition condition;
+            uint8_t value;
+        };
+
+        //Accesses are at most a few dozen bytes, so they touch at most the first and last byte's pages
+        static bool onPage(uint8_t const* pages, uint16_t address, unsigned int length) {
+            uint16_t last = address + length - 1;
+            return pages[address >> PAGE_SHIFT] | pages[last >> PAGE_SHIFT];
+        }
+
+        void checkWatchpoints(uint16_t address, unsigned int length, Stop kind);
+        void checkConditions(uint8_t const* registers);
+        void rebuildPages();
+
+        uint64_t breakpoints[65536 / 64]{};
+        uint8_t readPages[PAGES]{}; //Pages with a read watchpoint on them
+        uint8_t writePages[PAGES]{}; //Pages with a write watchpoint on them
+
+        std::vector<Watchpoint> watchpoints;
+        std::vector<RegisterCondition> conditions;
+        uint8_t lastRegisters[16]{}; //Register values after the previous instruction, for the conditions
+        bool haveLastRegisters{};
+
+        Stop stopReason{Stop::NONE};
+        uint16_t stopAddress{};
+        uint8_t stopRegister{};
+        bool skipBreakpoint{};
+        unsigned int stepsLeft{};
+
+};
+
+
+
+
+//-------------SETTING BREAKPOINTS------------
+
+inline void DebugHooks::addBreakpoint(uint16_t address) {
+    breakpoints[address >> 6u] |= uint64_t{1} << (address & 63u);
+}
+
+inline void DebugHooks::removeBreakpoint(uint16_t address) {
+    breakpoints[address >> 6u] &= ~(uint64_t{1} << (address & 63u));
+}
+
+inline void DebugHooks::addWatchpoint(uint16_t address, unsigned int length, bool read, bool write) {
+    if (length == 0 || (!read && !write)) {
+        return;
+    }
+
+    watchpoints.push_back(Watchpoint{ address, std::min(length, 65536u), read, write });
+    rebuildPages();
+}
+
+inline void DebugHooks::removeWatchpoint(uint16_t address) {
+    watchpoints.erase(std::remove_if(watchpoints.begin(), watchpoints.end(),
+        [address](Watchpoint const& watchpoint) { return watchpoint.address == address; }), watchpoints.end());
+    rebuildPages();
+}
+
+inline void DebugHooks::addCondition(uint8_t reg, Condition condition, uint8_t value) {
+    conditions.push_back(RegisterCondition{ static_cast<uint8_t>(reg & 0x0Fu), condition, value });
+    haveLastRegisters = false; //The registers were not being tracked, so the first instruction only records them
+}
+
+inline void DebugHooks::removeConditions(uint8_t reg) {
+    conditions.erase(std::remove_if(conditions.begin(), conditions.end(),
+        [reg](RegisterCondition const& condition) { return condition.reg == (reg & 0x0Fu); }), conditions.end());
+}
+
+inline void DebugHooks::clear() {
+    memset(breakpoints, 0, sizeof(breakpoints));
+    watchpoints.clear();
+    conditions.clear();
+    rebuildPages();
+}
+
+//Marks every page a watchpoint covers, so accesses elsewhere skip the precise check
+inline void DebugHooks::rebuildPages() {
+    memset(readPages, 0, sizeof(readPages));
+    memset(writePages, 0, sizeof(writePages));
+
+    for (Watchpoint const& watchpoint : watchpoints) {
+        unsigned int pages = ((watchpoint.address & ((1u << PAGE_SHIFT) - 1)) + watchpoint.length - 1) >> PAGE_SHIFT;
+
+        for (unsigned int page = 0; page <= pages && page < PAGES; ++page) {
+            unsigned int index = ((watchpoint.address >> PAGE_SHIFT) + page) % PAGES;
+
+            readPages[index] |= watchpoint.read;
+            writePages[index] |= watchpoint.write;
+        }
+    }
+}
+
+
+
+
+//-------------STEP CONTROL------------
+
+inline void DebugHooks::resume() {
+    skipBreakpoint = (stopReason == Stop::BREAKPOINT);
+    stopReason = Stop::NONE;
+    stepsLeft = 0;
+}
+
+inline void DebugHooks::step(unsigned int instructions) {
+    resume();
+    stepsLeft = instructions;
+}
+
+
+
+
+//-------------CHECKS------------
+
+//Stops on the first watched byte of the access. Addresses are 16 bits, enough for every memory
+//size, and ranges wrap around the top of them
+inline void DebugHooks::checkWatchpoints(uint16_t address, unsigned int length, Stop kind) {
+    for (Watchpoint const& watchpoint : watchpoints) {
+
+        if ((kind == Stop::READ && !watchpoint.read) || (kind == Stop::WRITE && !watchpoint.write)) {
+            continue;
+        }
+
+        for (unsigned int i = 0; i < length; ++i) {
+            uint16_t byte = address + i;
+
+            if (static_cast<uint16_t>(byte - watchpoint.address) < watchpoint.length) {
+                if (stopReason == Stop::NONE) {
+                    stopReason = kind;
+                    stopAddress = byte;
+                }
+                return;
+            }
+        }
+
+    }
+}
+
+inline void DebugHooks::checkConditions(uint8_t const* registers) {
+    if (haveLastRegisters && stopReason == Stop::NONE) {
+
+        for (RegisterCondition const& condition : conditions) {
+
+            uint8_t before = lastRegisters[condition.reg];
+            uint8_t after = registers[condition.reg];
+
+            bool hit = (before != after) && (condition.condition == Condition::CHANGED || after == condition.value);
+
+            if (hit) {
+                stopReason = Stop::REGISTER;
+                stopRegister = condition.reg;
+                break;
+            }
+
+        }
+
+    }
+
+    memcpy(lastRegisters, registers, sizeof(lastRegisters));
+    haveLastRegisters = true;
+}
+
+
+
+
+//The debuggable machines, the same as the normal ones apart from their hooks
+struct DebugChip8Config : Chip8Config {
+    typedef DebugHooks Hooks;
+};
+
+struct DebugSuperChip8Config : SuperChip8Config {
+    typedef DebugHooks Hooks;
+};
+
+struct DebugXOChip8Config : XOChip8Config {
+    typedef DebugHooks Hooks;
+};
+
+typedef Chip8Machine<DebugChip8Config> DebugChip8;
+typedef Chip8Machine<DebugSuperChip8Config> DebugSuperChip8;
+typedef Chip8Machine<DebugXOChip8Config> DebugXOChip8;
+
+//Runs one frame from wherever the machine stopped. It stops early if anything else is hit
+template <class Machine>
+void stepFrame(Machine& machine) {
+    machine.hooks.resume();
+    machine.Frame();
+}
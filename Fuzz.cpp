@@ -0,0 +1,296 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "Chip8.hpp"
+
+//In-process coverage guided ROM fuzzer
+//
+//Every test case is a key sequence followed by ROM bytes. A case is run on one machine that is
+//reset() between runs, rather than constructed again, and coverage is the set of (PC, opcode
+//handler) edges it hit. Cases that hit a new edge are kept in the corpus and written to the
+//corpus directory. Build it with -fsanitize=address,undefined so out of bounds accesses in the
+//opcode functions stop the run.
+//
+//Cases run on FuzzChip8, which is Chip8 without the running state hash. Nothing here reads the
+//hash, and keeping it up to date costs more than running a short case
+//
+//Built with -DFUZZ_WITH_LIBFUZZER (and clang's -fsanitize=fuzzer) it is a libFuzzer target
+//instead, reporting the same edges through libFuzzer's extra counters
+
+
+
+
+//-------------CONSTANTS------------
+
+const unsigned int MAX_FRAMES = 8; //Frames each case runs for, short so cases stay cheap
+const unsigned int COVERAGE_SIZE = 1 << 16; //Edge counters, indexed by a hash of the edge
+const unsigned int MAX_CASE_SIZE = 1 + 255 + 4096 - 0x200;
+
+
+
+
+//-------------RUNNING ONE CASE------------
+
+#ifdef FUZZ_WITH_LIBFUZZER
+__attribute__((section("__libfuzzer_extra_counters")))
+#endif
+uint8_t coverage[COVERAGE_SIZE];
+
+std::vector<unsigned int> touched; //Counters the current case moved off 0, so they can be checked without scanning them all
+
+//Opcode bits the second level tables in Chip8::Cycle() dispatch on, by the opcode's first hex digit
+const uint16_t HANDLER_BITS[16] = {
+    0x00FF, 0, 0, 0, 0, 0x000F, 0, 0, 0x000F, 0, 0, 0, 0, 0, 0x00FF, 0x00FF
+};
+
+//Which opcode function the table dispatch in Chip8::Cycle() would pick, as one number. A lookup
+//rather than a switch, since the opcodes of random ROMs make any branch here a guess
+unsigned int handlerOf(uint16_t opcode) {
+    unsigned int group = opcode >> 12u;
+    return (group << 8) | (opcode & HANDLER_BITS[group]);
+}
+
+//Runs one case on the machine and marks the edges it hit. The first byte of a case says how many
+//key events follow it. Each event sets one key (low 4 bits) up or down (bit 4) before a frame, and
+//everything after the events is the ROM
+void runCase(FuzzChip8& machine, uint8_t const* data, size_t size) {
+
+    if (size == 0) {
+        return;
+    }
+
+    size_t events = data[0];
+    if (events > size - 1) {
+        events = size - 1;
+    }
+
+    uint8_t const* keyEvents = data + 1;
+    uint8_t const* rom = data + 1 + events;
+
+    machine.reset();
+    machine.seed(0);
+    machine.loadROM(rom, size - 1 - events);
+
+    unsigned int previous = 0;
+
+    for (unsigned int frame = 0; frame < MAX_FRAMES; ++frame) {
+
+        if (frame < events) {
+            machine.keys[keyEvents[frame] & 0x0Fu] = (keyEvents[frame] >> 4u) & 0x01u;
+        }
+
+        for (unsigned int i = 0; i < FuzzChip8::CYCLES_PER_FRAME; ++i) {
+
+            uint16_t pc = machine.getProgramCounter();
+            uint16_t opcode = (machine.readMemory(pc) << 8u) | machine.readMemory(pc + 1);
+
+            unsigned int edge = (pc << 12) ^ handlerOf(opcode);
+            unsigned int index = ((edge ^ (previous >> 1)) * 0x9E3779B1u) >> 16;
+
+            if (coverage[index] == 0) {
+                touched.push_back(index);
+            }
+            if (coverage[index] < 255) {
+                ++coverage[index];
+            }
+            previous = edge;
+
+            machine.Cycle();
+
+        }
+
+    }
+
+}
+
+
+
+
+#ifdef FUZZ_WITH_LIBFUZZER
+
+extern "C" int LLVMFuzzerTestOneInput(uint8_t const* data, size_t size) {
+    static FuzzChip8 machine;
+
+    runCase(machine, data, size);
+    touched.clear(); //libFuzzer clears the counters itself
+    return 0;
+}
+
+#else
+
+//-------------MUTATION------------
+
+std::mt19937 randomGenerator(12345);
+
+unsigned int randomBelow(unsigned int limit) {
+    return std::uniform_int_distribution<unsigned int>(0, limit - 1)(randomGenerator);
+}
+
+//Makes a new case from a corpus entry, with one of a handful of byte level changes. The result
+//reuses the last case's buffer, so making a case does not go to the heap
+void mutate(std::vector<std::vector<uint8_t>> const& corpus, std::vector<uint8_t>& result) {
+
+    std::vector<uint8_t> const& entry = corpus[randomBelow(corpus.size())];
+    result.assign(entry.begin(), entry.end());
+
+    if (result.empty()) {
+        result.push_back(0);
+    }
+
+    unsigned int changes = 1 + randomBelow(4);
+
+    for (unsigned int change = 0; change < changes; ++change) {
+
+        switch (randomBelow(6)) {
+
+            case 0: { //Flip a bit
+                result[randomBelow(result.size())] ^= 1u << randomBelow(8);
+            } break;
+
+            case 1: { //Set a byte
+                result[randomBelow(result.size())] = randomBelow(256);
+            } break;
+
+            case 2: { //Insert an instruction sized pair of bytes
+                size_t at = randomBelow(result.size() + 1);
+                uint8_t pair[2] = { static_cast<uint8_t>(randomBelow(256)), static_cast<uint8_t>(randomBelow(256)) };
+                result.insert(result.begin() + at, pair, pair + 2);
+            } break;
+
+            case 3: { //Delete a pair of bytes
+                if (result.size() > 3) {
+                    size_t at = randomBelow(result.size() - 2);
+                    result.erase(result.begin() + at, result.begin() + at + 2);
+                }
+            } break;
+
+            case 4: { //Change the number of key events
+                result[0] = randomBelow(MAX_FRAMES + 1);
+            } break;
+
+            case 5: { //Splice in the tail of another entry
+                std::vector<uint8_t> const& other = corpus[randomBelow(corpus.size())];
+                if (!other.empty()) {
+                    size_t at = randomBelow(result.size());
+                    size_t from = randomBelow(other.size());
+                    result.resize(at);
+                    result.insert(result.end(), other.begin() + from, other.end());
+                }
+            } break;
+
+        }
+
+    }
+
+    if (result.size() > MAX_CASE_SIZE) {
+        result.resize(MAX_CASE_SIZE);
+    }
+
+}
+
+//Adds a case's edges to the ones seen so far, returning if any were new
+bool mergeCoverage(std::vector<uint8_t>& seen) {
+    bool found = false;
+
+    for (unsigned int index : touched) {
+        if (!seen[index]) {
+            seen[index] = 1;
+            found = true;
+        }
+        coverage[index] = 0;
+    }
+
+    touched.clear();
+
+    return found;
+}
+
+
+
+
+int main(int argc, char** argv) {
+
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <CorpusDirectory> <Runs> [SeedROM...]\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    std::string corpusDirectory = argv[1];
+    unsigned long runs = std::strtoul(argv[2], nullptr, 10);
+
+    //Checked up front, since every case kept would otherwise be lost without a word
+    struct stat directory;
+    if (stat(corpusDirectory.c_str(), &directory) != 0 || !S_ISDIR(directory.st_mode)) {
+        std::cerr << "Corpus directory " << corpusDirectory << " does not exist\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    //Seed ROMs start out with no key events
+    std::vector<std::vector<uint8_t>> corpus;
+
+    for (int i = 3; i < argc; ++i) {
+        std::ifstream file(argv[i], std::ios::binary);
+        std::vector<uint8_t> entry{ 0 };
+        entry.insert(entry.end(), std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        corpus.push_back(entry);
+    }
+
+    if (corpus.empty()) {
+        corpus.push_back(std::vector<uint8_t>{ 0, 0x00, 0xE0 });
+    }
+
+    static FuzzChip8 machine;
+    std::vector<uint8_t> seen(COVERAGE_SIZE);
+    unsigned long kept = 0;
+
+    for (auto const& entry : corpus) {
+        runCase(machine, entry.data(), entry.size());
+        mergeCoverage(seen);
+    }
+
+    std::vector<uint8_t> candidate;
+    auto start = std::chrono::steady_clock::now();
+
+    for (unsigned long run = 0; run < runs; ++run) {
+
+        mutate(corpus, candidate);
+        runCase(machine, candidate.data(), candidate.size());
+
+        if (!mergeCoverage(seen)) {
+            continue;
+        }
+
+        //Keeps the case, named by its place in the corpus
+        std::string path = corpusDirectory + "/case" + std::to_string(corpus.size());
+        std::ofstream out(path, std::ios::binary);
+        out.write(reinterpret_cast<char const*>(candidate.data()), candidate.size());
+
+        if (!out) {
+            std::cerr << "Could not write " << path << "\n";
+            std::exit(EXIT_FAILURE);
+        }
+
+        corpus.push_back(candidate);
+        ++kept;
+
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "Ran " << runs << " cases in " << seconds << " s (" << static_cast<unsigned long>(runs / seconds) << " per second), corpus grew by "
+              << kept << " to " << corpus.size() << " cases\n";
+
+    return 0;
+
+}
+
+#endif
@@ -0,0 +1,151 @@
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "InstancePool.hpp"
+
+//The NUMA calls go straight to the kernel, so there is no dependency on libnuma. On machines
+//without NUMA the node is always 0 and binding is skipped
+
+
+
+
+//-------------CONSTANTS------------
+
+const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+const unsigned int MAX_NODES = 1024;
+
+
+
+
+//-------------TOPOLOGY------------
+
+//Reads a kernel list like "0-3,8,10-11" into the numbers it names
+static std::vector<unsigned int> readList(std::string const& path) {
+    std::ifstream file(path);
+    std::string text;
+    std::vector<unsigned int> values;
+
+    if (!std::getline(file, text)) {
+        return values;
+    }
+
+    size_t position = 0;
+
+    while (position < text.size()) {
+        size_t end = text.find(',', position);
+        if (end == std::string::npos) {
+            end = text.size();
+        }
+
+        std::string range = text.substr(position, end - position);
+        size_t dash = range.find('-');
+
+        if (!range.empty()) {
+            unsigned int first = std::stoul(range.substr(0, dash));
+            unsigned int last = (dash == std::string::npos) ? first : std::stoul(range.substr(dash + 1));
+
+            for (unsigned int value = first; value <= last; ++value) {
+                values.push_back(value);
+            }
+        }
+
+        position = end + 1;
+    }
+
+    return values;
+}
+
+unsigned int Numa::nodeCount() {
+    static unsigned int count = [] {
+        std::vector<unsigned int> nodes = readList("/sys/devices/system/node/online");
+        return nodes.empty() ? 1u : nodes.back() + 1;
+    }();
+
+    return count;
+}
+
+std::vector<unsigned int> Numa::cpusOf(unsigned int node) {
+    return readList("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+}
+
+bool Numa::pinThread(unsigned int node) {
+    std::vector<unsigned int> cpus = cpusOf(node);
+
+    if (cpus.empty()) {
+        return false;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+
+    for (unsigned int cpu : cpus) {
+        if (cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+
+
+
+//-------------ARENAS------------
+
+void* Numa::allocate(size_t bytes, unsigned int node, bool& hugePages, bool& bound) {
+
+    //Huge page mappings have to be whole huge pages
+    size_t rounded = (bytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+
+    void* memory = mmap(nullptr, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    hugePages = (memory != MAP_FAILED);
+
+    //No huge pages reserved, so ask for transparent ones instead. Those only back 2MB aligned
+    //ranges, so an extra huge page is mapped and the slack on either side of the aligned start cut off
+    if (!hugePages) {
+        size_t mapped = rounded + HUGE_PAGE_SIZE;
+        void* base = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (base == MAP_FAILED) {
+            return nullptr;
+        }
+
+        uintptr_t start = (reinterpret_cast<uintptr_t>(base) + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+        size_t head = start - reinterpret_cast<uintptr_t>(base);
+
+        if (head) {
+            munmap(base, head);
+        }
+        munmap(reinterpret_cast<void*>(start + rounded), HUGE_PAGE_SIZE - head);
+
+        memory = reinterpret_cast<void*>(start);
+        hugePages = (madvise(memory, rounded, MADV_HUGEPAGE) == 0);
+    }
+
+    //Binding has to happen before the pages are first touched. A failure only costs locality
+    bound = true;
+
+    if (nodeCount() > 1 && node < MAX_NODES) {
+        unsigned long mask[MAX_NODES / (8 * sizeof(unsigned long))]{};
+        mask[node / (8 * sizeof(unsigned long))] = 1ul << (node % (8 * sizeof(unsigned long)));
+
+        bound = (syscall(SYS_mbind, memory, rounded, MPOL_BIND, mask, MAX_NODES, 0) == 0);
+    }
+
+    return memory;
+
+}
+
+void Numa::release(void* memory, size_t bytes) {
+    size_t rounded = (bytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    munmap(memory, rounded);
+}
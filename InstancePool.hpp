@@ -0,0 +1,156 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+//Pools of machines allocated from per NUMA node arenas
+//
+//A pool reserves one arena for all of its machines, bound to a NUMA node and backed by huge pages
+//when the system has them, so a worker running thousands of sessions touches local memory and
+//few TLB entries. Slots are handed out in address order, so pages are only touched once a machine
+//needs them. Destroyed slots are kept in a list threaded through the slots themselves and reused
+//first, so creating and destroying machines never goes to the heap. A pool is not thread safe: each worker
+//thread owns one, pinned to the pool's node, and is the only thread that touches its machines
+namespace Numa {
+
+    unsigned int nodeCount(); //Number of NUMA nodes, 1 on machines without NUMA
+    std::vector<unsigned int> cpusOf(unsigned int node);
+    bool pinThread(unsigned int node); //Restricts the calling thread to the node's CPUs
+
+    //Anonymous memory bound to the node, from huge pages if any are free and transparent huge pages
+    //otherwise. hugePages and bound report whether either worked, a failure only costs speed
+    void* allocate(size_t bytes, unsigned int node, bool& hugePages, bool& bound);
+    void release(void* memory, size_t bytes);
+
+}
+
+template <class Machine>
+class InstancePool {
+
+    static_assert(std::is_trivially_destructible<Machine>::value, "Pooled machines are dropped without running a destructor");
+
+    public:
+        //Slots are whole cache lines, so neighbouring machines never share one
+        static constexpr size_t SLOT_SIZE = (sizeof(Machine) + 63) & ~size_t{63};
+
+        InstancePool(uint32_t capacity, unsigned int node) : slotCount(capacity), node(node) {
+            arenaSize = static_cast<size_t>(capacity) * SLOT_SIZE;
+            arena = static_cast<uint8_t*>(Numa::allocate(arenaSize, node, hugePages, bound));
+        }
+
+        ~InstancePool() {
+            if (arena) {
+                Numa::release(arena, arenaSize);
+            }
+        }
+
+        InstancePool(InstancePool const&) = delete;
+        InstancePool& operator=(InstancePool const&) = delete;
+
+        //A new machine, or nullptr if the pool is full
+        Machine* create() {
+            uint8_t* slot = take();
+            return slot ? new (slot) Machine() : nullptr;
+        }
+
+        void destroy(Machine* machine) {
+            uint32_t slot = static_cast<uint32_t>((reinterpret_cast<uint8_t*>(machine) - arena) / SLOT_SIZE);
+
+            machine->~Machine();
+            setNext(slot, freeHead);
+            freeHead = slot;
+            --live;
+        }
+
+        //Creates up to count machines, returning how many it made. Only the first is constructed,
+        //the rest are copies of it given seeds of their own, which skips rebuilding the font memory
+        //and its hash for every one
+        uint32_t create(uint32_t count, Machine** machines) {
+            if (count == 0) {
+                return 0;
+            }
+
+            Machine* first = create();
+
+            if (!first) {
+                return 0;
+            }
+
+            machines[0] = first;
+            uint32_t made = 1;
+            unsigned int seed = static_cast<unsigned int>(reinterpret_cast<uintptr_t>(first)) ^ static_cast<unsigned int>(live);
+
+            while (made < count) {
+                uint8_t* slot = take();
+
+                if (!slot) {
+                    break;
+                }
+
+                Machine* machine = new (slot) Machine(*first);
+                machine->seed(seed + made * 0x9E3779B9u);
+                machines[made++] = machine;
+            }
+
+            return made;
+        }
+
+        void destroy(uint32_t count, Machine* const* machines) {
+            for (uint32_t i = 0; i < count; ++i) {
+                destroy(machines[i]);
+            }
+        }
+
+        uint32_t capacity() const { return arena ? slotCount : 0; }
+        uint32_t size() const { return live; }
+        unsigned int homeNode() const { return node; }
+        bool usesHugePages() const { return hugePages; }
+        bool boundToNode() const { return bound; }
+
+    private:
+        //A destroyed slot if there is one, otherwise the next never used slot. The first touch of a
+        //never used slot is its page's first touch, which is why workers make their pools after pinning
+        uint8_t* take() {
+            uint32_t slot;
+
+            if (freeHead != NO_SLOT) {
+                slot = freeHead;
+                freeHead = next(slot);
+            } else if (arena && used < slotCount) {
+                slot = used++;
+            } else {
+                return nullptr;
+            }
+
+            ++live;
+            return arena + slot * SLOT_SIZE;
+        }
+
+        //A destroyed slot's first bytes hold the index of the next destroyed slot
+        uint32_t next(uint32_t slot) const {
+            uint32_t value;
+            memcpy(&value, arena + slot * SLOT_SIZE, sizeof(value));
+            return value;
+        }
+
+        void setNext(uint32_t slot, uint32_t value) {
+            memcpy(arena + slot * SLOT_SIZE, &value, sizeof(value));
+        }
+
+        uint8_t* arena{};
+        size_t arenaSize{};
+        static constexpr uint32_t NO_SLOT = UINT32_MAX;
+
+        uint32_t slotCount;
+        uint32_t used{}; //Slots below this have held a machine, the rest have never been touched
+        uint32_t freeHead = NO_SLOT; //Most recently destroyed slot
+        uint32_t live{};
+        unsigned int node;
+        bool hugePages{};
+        bool bound{};
+
+};
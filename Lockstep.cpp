@@ -0,0 +1,149 @@
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "Chip8.hpp"
+#include "StaticRuntime.hpp"
+
+//Lockstep divergence checker
+//
+//Runs the same ROM on two engines side by side and compares their state hashes once per frame.
+//When the hashes differ, both engines are rolled back to the start of the frame and rerun for 1,
+//2, 3... cycles to find the exact cycle they split on, then both states are printed. Each rerun
+//is a single run() call, since a translated block only runs when it fits in the cycles asked for.
+//Link it together with a translation made by the Recompiler to check StaticRuntime against the
+//interpreter, see the README
+
+
+
+
+//One way of running a Chip8 machine
+class Engine {
+
+    public:
+        virtual ~Engine() {}
+        virtual void run(unsigned int cycles) = 0;
+
+        Chip8 machine;
+
+};
+
+//The table interpreter, calling Chip8::Cycle() for every instruction
+class InterpreterEngine : public Engine {
+
+    public:
+        void run(unsigned int cycles) override {
+            for (unsigned int i = 0; i < cycles; ++i) {
+                machine.Cycle();
+            }
+        }
+
+};
+
+//The ahead of time translation, run through StaticRuntime
+class StaticEngine : public Engine {
+
+    public:
+        StaticEngine() : runtime(machine) {}
+
+        void run(unsigned int cycles) override {
+            runtime.run(cycles);
+        }
+
+    private:
+        StaticRuntime runtime;
+
+};
+
+std::unique_ptr<Engine> makeEngine(std::string const& name) {
+    if (name == "interpreter") {
+        return std::unique_ptr<Engine>(new InterpreterEngine());
+    }
+    if (name == "static") {
+        return std::unique_ptr<Engine>(new StaticEngine());
+    }
+
+    std::cerr << "Unknown engine " << name << ", expected interpreter or static\n";
+    std::exit(EXIT_FAILURE);
+}
+
+//Prints the memory and display differences the state dumps do not show
+void printDifferences(Chip8 const& a, Chip8 const& b) {
+    for (unsigned int address = 0; address < Chip8::MEMORY_SIZE; ++address) {
+        if (a.readMemory(address) != b.readMemory(address)) {
+            std::cout << "memory[" << address << "]: " << unsigned(a.readMemory(address)) << " vs " << unsigned(b.readMemory(address)) << "\n";
+        }
+    }
+
+    for (unsigned int i = 0; i < sizeof(a.display) / sizeof(a.display[0]); ++i) {
+        if (a.display[i] != b.display[i]) {
+            std::cout << "display row " << i / Chip8::DISPLAY_WORDS << " differs\n";
+        }
+    }
+}
+
+
+
+
+int main(int argc, char** argv) {
+
+    if (argc < 3 || argc > 6) {
+        std::cerr << "Usage: " << argv[0] << " <ROM> <Frames> [CyclesPerFrame] [EngineA] [EngineB]\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    char const* romFilename = argv[1];
+    unsigned long frames = std::strtoul(argv[2], nullptr, 10);
+    unsigned int cyclesPerFrame = (argc > 3) ? std::atoi(argv[3]) : Chip8::CYCLES_PER_FRAME;
+    std::unique_ptr<Engine> a = makeEngine((argc > 4) ? argv[4] : "interpreter");
+    std::unique_ptr<Engine> b = makeEngine((argc > 5) ? argv[5] : "static");
+
+    //Both machines need the same random numbers to stay in step
+    a->machine.seed(1);
+    b->machine.seed(1);
+    a->machine.loadROM(romFilename);
+    b->machine.loadROM(romFilename);
+
+    for (unsigned long frame = 0; frame < frames; ++frame) {
+
+        //Kept so a diverging frame can be replayed
+        Chip8 startA = a->machine;
+        Chip8 startB = b->machine;
+
+        a->run(cyclesPerFrame);
+        b->run(cyclesPerFrame);
+
+        if (a->machine.stateHash() == b->machine.stateHash()) {
+            continue;
+        }
+
+        for (unsigned int cycle = 0; cycle < cyclesPerFrame; ++cycle) {
+
+            a->machine = startA;
+            b->machine = startB;
+
+            a->run(cycle + 1);
+            b->run(cycle + 1);
+
+            if (a->machine.stateHash() != b->machine.stateHash()) {
+                std::cout << "Diverged at cycle " << frame * cyclesPerFrame + cycle << " (frame " << frame << ")\n\n";
+                std::cout << "Engine A:\n";
+                a->machine.dumpState(std::cout);
+                std::cout << "\nEngine B:\n";
+                b->machine.dumpState(std::cout);
+                std::cout << "\n";
+                printDifferences(a->machine, b->machine);
+                return EXIT_FAILURE;
+            }
+
+        }
+
+    }
+
+    std::cout << "No divergence in " << frames << " frames\n";
+
+    return 0;
+
+}
@@ -1,51 +1,204 @@
 #include <chrono>
+#include <cstring>
 #include <iostream>
+#include <string>
+#include <type_traits>
+#include <vector>
 
 #include "Chip8.hpp"
 #include "Platform.hpp"
+#include "Telemetry.hpp"
+#include "Trace.hpp"
+
+//Runs the emulator loop for one kind of machine, since each machine has its own display size
+//
+//With run ahead, every frame is followed by runAhead more frames run on the current keys without
+//drawing them. The last of those is presented, then the machine is rolled back to where the real
+//frame left it. A ROM that takes a few frames to react to a key shows the reaction that many
+//frames sooner. This loop presents after every instruction, so a frame here is one Cycle().
+//Rolling back is a plain copy, since the machine is trivially copyable
+template <class Machine>
+int runEmulator(int videoScale, int cycleDelay, char const* romFilename, unsigned int runAhead, TraceWriter* trace) {
+
+    int VIDEO_WIDTH = Machine::VIDEO_WIDTH;
+    int VIDEO_HEIGHT = Machine::VIDEO_HEIGHT;
 
-int main(int argc, char** argv) { //Main method which all C++ programs start from, with argc being num args and argv being the list of args passed through
-
-    std::cout << "Hello";
+    Platform platform("CHIP-8 Emulator", VIDEO_WIDTH * videoScale, VIDEO_HEIGHT * videoScale, VIDEO_WIDTH, VIDEO_HEIGHT);
 
-    int VIDEO_WIDTH = 32;
-    int VIDEO_HEIGHT = 16;
+    Machine chip8;
+    chip8.loadROM(romFilename);
 
-    if (argc != 4) {
-        std::cerr << "Usage: " << argv[0] << " <Scale> <Delay> <ROM>\n";
-        std::exit(EXIT_FAILURE);
+    if constexpr (std::is_same<typename Machine::Hooks, TraceHooks>::value) {
+        chip8.hooks.attach(*trace, trace->newStream());
     }
 
-    int videoScale = std::atoi(argv[1]); //Interpret signed integer from string
-    int cycleDelay = std::atoi(argv[2]);
-    char* const romFilename = argv[3];
+    //The machine's display is bit packed, so it gets expanded into this buffer before drawing
+    static uint32_t pixels[Machine::VIDEO_WIDTH * Machine::VIDEO_HEIGHT]{};
 
-    Platform platform("CHIP-8 Emulator", VIDEO_WIDTH * videoScale, VIDEO_HEIGHT * videoScale, VIDEO_WIDTH, VIDEO_HEIGHT);
-
-    Chip8 chip8;
-    chip8.loadROM(romFilename);
-
-    int videoPitch = sizeof(chip8.display[0]) * VIDEO_WIDTH;
+    int videoPitch = sizeof(pixels[0]) * VIDEO_WIDTH;
 
     auto lastCycleTime = std::chrono::high_resolution_clock::now();
     bool quit = false;
 
+    //Telemetry state. Key changes are timed from when they are read to when their frame is presented
+    auto lastPresentTime = std::chrono::steady_clock::now();
+    auto inputTime = lastPresentTime;
+    bool inputPending = false;
+    uint8_t previousKeys[sizeof(chip8.keys)];
+
     //Keeps running to update the program
     while (!quit) {
 
-        quit = platform.ProcessInput(chip8.keys);
+        memcpy(previousKeys, chip8.keys, sizeof(previousKeys));
+
+        {
+            Telemetry::ScopeTimer timer(Telemetry::INPUT_TIME);
+            quit = platform.ProcessInput(chip8.keys);
+        }
+
+        if (!inputPending && memcmp(previousKeys, chip8.keys, sizeof(previousKeys)) != 0) {
+            inputPending = true;
+            inputTime = std::chrono::steady_clock::now();
+        }
 
         auto currentTime = std::chrono::high_resolution_clock::now();
         float dt = std::chrono::duration<float, std::chrono::milliseconds::period>(currentTime - lastCycleTime).count();
 
         if (dt > cycleDelay) {
             lastCycleTime = currentTime;
-            chip8.Cycle();
-            platform.Update(chip8.display, videoPitch);
+
+            {
+                Telemetry::ScopeTimer timer(Telemetry::CYCLE_TIME);
+                chip8.Cycle();
+            }
+
+            auto presentStart = std::chrono::steady_clock::now();
+
+            if (runAhead > 0) {
+                Machine real = chip8;
+
+                for (unsigned int i = 0; i < runAhead; ++i) {
+                    chip8.Cycle();
+                }
+
+                chip8.renderPixels(pixels);
+                chip8 = real;
+            }
+            else {
+                chip8.renderPixels(pixels);
+            }
+
+            {
+                Telemetry::ScopeTimer timer(Telemetry::UPDATE_TIME);
+                platform.Update(pixels, videoPitch);
+            }
+
+            auto presentTime = std::chrono::steady_clock::now();
+            auto frameTime = presentTime - lastPresentTime;
+
+            Telemetry::count(Telemetry::FRAMES);
+            Telemetry::count(Telemetry::INSTRUCTIONS, 1 + runAhead);
+            Telemetry::record(Telemetry::INSTRUCTIONS_PER_FRAME, 1 + runAhead); //This loop presents after every instruction, plus the speculative ones
+            Telemetry::record(Telemetry::FRAME_TIME, frameTime);
+            Telemetry::record(Telemetry::PRESENT_TIME, presentTime - presentStart);
+
+            if (cycleDelay > 0 && frameTime >= 2 * std::chrono::milliseconds(cycleDelay)) {
+                Telemetry::count(Telemetry::LATE_FRAMES);
+            }
+            if (inputPending) {
+                Telemetry::record(Telemetry::INPUT_LATENCY, presentTime - inputTime);
+                inputPending = false;
+            }
+
+            lastPresentTime = presentTime;
+            chip8.hooks.endFrame(); //Marks the frame in the trace, if there is one
         }
 
     }
 
+    if constexpr (std::is_same<typename Machine::Hooks, TraceHooks>::value) {
+        chip8.hooks.detach();
+    }
+
     return 0;
 
-}
\ No newline at end of file
+}
+
+int main(int argc, char** argv) { //Main method which all C++ programs start from, with argc being num args and argv being the list of args passed through
+
+    std::cout << "Hello";
+
+    //--run-ahead=N and --trace=File can go anywhere, everything else is positional
+    std::vector<char*> args;
+    unsigned int runAhead = 0;
+    char const* tracePath = nullptr;
+
+    for (int i = 0; i < argc; ++i) {
+        if (std::strncmp(argv[i], "--run-ahead=", 12) == 0) {
+            runAhead = std::atoi(argv[i] + 12);
+        }
+        else if (std::strncmp(argv[i], "--trace=", 8) == 0) {
+            tracePath = argv[i] + 8;
+        }
+        else {
+            args.push_back(argv[i]);
+        }
+    }
+
+    if (args.size() < 4 || args.size() > 6) {
+        std::cerr << "Usage: " << args[0] << " <Scale> <Delay> <ROM> [chip8|schip|xochip] [MetricsPath] [--run-ahead=Frames] [--trace=File]\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    int videoScale = std::atoi(args[1]); //Interpret signed integer from string
+    int cycleDelay = std::atoi(args[2]);
+    char* const romFilename = args[3];
+    char const* machine = (args.size() >= 5) ? args[4] : "chip8";
+
+    //Metrics go to a stats file when the path ends in .prom, the textfile collector convention, and are served on a Unix socket otherwise
+    if (args.size() == 6) {
+        std::string metricsPath = args[5];
+
+        if (metricsPath.size() > 5 && metricsPath.compare(metricsPath.size() - 5, 5, ".prom") == 0) {
+            Telemetry::writeFile(args[5], std::chrono::seconds(1));
+        }
+        else if (!Telemetry::serve(args[5])) {
+            std::cerr << "Could not serve metrics on " << args[5] << "\n";
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+    //Tracing runs the traced build of the machine, and its speculative frames would end up in the trace
+    if (tracePath) {
+        if (runAhead > 0) {
+            std::cerr << "--trace and --run-ahead can not be used together\n";
+            std::exit(EXIT_FAILURE);
+        }
+
+        TraceWriter trace(tracePath);
+
+        if (!trace.ok()) {
+            std::cerr << "Could not write trace " << tracePath << "\n";
+            std::exit(EXIT_FAILURE);
+        }
+
+        if (std::strcmp(machine, "schip") == 0) {
+            return runEmulator<TraceSuperChip8>(videoScale, cycleDelay, romFilename, 0, &trace);
+        }
+        if (std::strcmp(machine, "xochip") == 0) {
+            return runEmulator<TraceXOChip8>(videoScale, cycleDelay, romFilename, 0, &trace);
+        }
+
+        return runEmulator<TraceChip8>(videoScale, cycleDelay, romFilename, 0, &trace);
+    }
+
+    if (std::strcmp(machine, "schip") == 0) {
+        return runEmulator<SuperChip8>(videoScale, cycleDelay, romFilename, runAhead, nullptr);
+    }
+    if (std::strcmp(machine, "xochip") == 0) {
+        return runEmulator<XOChip8>(videoScale, cycleDelay, romFilename, runAhead, nullptr);
+    }
+
+    return runEmulator<Chip8>(videoScale, cycleDelay, romFilename, runAhead, nullptr);
+
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+
+//Binary protocol spoken over the emulator server's Unix socket
+//
+//Every message is a fixed size header followed by "length" bytes of payload, all in the host's
+//byte order since both ends are on the same machine. Replies echo the request's type, session
+//and tag, so a client can have many requests in flight and match the replies up. Requests for
+//one session are answered in order, replies for different sessions may arrive in any order
+
+namespace Protocol {
+
+    enum Type : uint8_t {
+        CREATE = 1, //Payload: uint64_t ROM hash. Reply session is the new session's id
+        DESTROY = 2, //No payload
+        KEYS = 3, //Payload: uint16_t with bit i set if key i is down
+        STEP = 4, //Payload: uint32_t number of frames to run
+        FRAME = 5, //No payload. Reply payload: the bit packed display of a Chip8
+        SNAPSHOT = 6 //No payload. Reply payload: a Chip8::Snapshot
+    };
+
+    enum Status : uint8_t {
+        OK = 0,
+        UNKNOWN_ROM = 1,
+        UNKNOWN_SESSION = 2,
+        BAD_REQUEST = 3,
+        SERVER_FULL = 4 //The worker the new session would live on has no room for it
+    };
+
+    struct RequestHeader {
+        uint8_t type;
+        uint8_t reserved[3];
+        uint32_t session;
+        uint32_t tag; //Any value the client likes, echoed back in the reply
+        uint32_t length; //Payload bytes following the header
+    };
+
+    struct ReplyHeader {
+        uint8_t type;
+        uint8_t status;
+        uint8_t reserved[2];
+        uint32_t session;
+        uint32_t tag;
+        uint32_t length;
+    };
+
+    const uint32_t MAX_PAYLOAD = 64 * 1024;
+
+    //64 bit FNV-1a hash, which is how clients name the ROMs the server has loaded
+    inline uint64_t romHash(uint8_t const* data, uint64_t size) {
+        uint64_t hash = 0xCBF29CE484222325ull;
+
+        for (uint64_t i = 0; i < size; ++i) {
+            hash ^= data[i];
+            hash *= 0x100000001B3ull;
+        }
+
+        return hash;
+    }
+
+}
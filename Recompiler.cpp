@@ -0,0 +1,356 @@
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+//Ahead of time recompiler which turns a CHIP8 ROM into a C++ translation unit for StaticRuntime
+//
+//It walks the ROM's control flow from the start address, splits the reachable code into basic
+//blocks and writes each block out as a function. The generated file gets compiled and linked
+//together with StaticRuntime.cpp and Chip8.cpp, see the README
+
+
+
+
+//-------------CONSTANTS------------
+
+//Starting address of the memory where the ROM file is stored
+const unsigned int START_ADDRESS = 0x200;
+
+const unsigned int MEMORY_SIZE = 4096;
+
+
+
+
+//-------------ROM ANALYSIS------------
+
+//How an instruction affects where execution goes next
+enum class Flow {
+    NEXT, //Carries on with the next instruction
+    END, //Ends the block, with the next address only known at runtime (returns, computed jumps, interpreted skips)
+    JUMP, //Ends the block, continuing at nnn
+    CALL, //Ends the block, continuing at nnn and later returning to the next instruction
+    SKIP, //Ends the block, continuing at either the next instruction or the one after
+    STOP //Ends the block after an interpreted instruction, continuing at the next instruction or repeating it
+};
+
+//Decodes how the instruction changes the control flow. This has to agree with the translations in emitInstruction()
+Flow instructionFlow(uint16_t opcode) {
+    switch (opcode >> 12u) {
+        case 0x0: return (opcode == 0x00EE) ? Flow::END : Flow::NEXT;
+        case 0x1: return Flow::JUMP;
+        case 0x2: return Flow::CALL;
+        case 0x3: case 0x4: return Flow::SKIP;
+        case 0x5: case 0x9: return ((opcode & 0x000Fu) == 0) ? Flow::SKIP : Flow::NEXT;
+        case 0xB: return Flow::END;
+        case 0xE: return Flow::SKIP;
+        case 0xF: {
+            uint8_t low = opcode & 0x00FFu;
+            //Waiting for a key repeats the instruction, and stores to memory may overwrite code
+            return (low == 0x0A || low == 0x33 || low == 0x55) ? Flow::STOP : Flow::NEXT;
+        }
+        default: return Flow::NEXT;
+    }
+}
+
+//Reads the ROM's instruction at address, or returns false past the end of the ROM
+bool fetch(std::vector<uint8_t> const& rom, unsigned int address, uint16_t& opcode) {
+    unsigned int offset = address - START_ADDRESS;
+
+    if (address < START_ADDRESS || offset + 1 >= rom.size()) {
+        return false;
+    }
+
+    opcode = (rom[offset] << 8u) | rom[offset + 1];
+    return true;
+}
+
+//Finds every reachable instruction and the addresses that start a basic block
+void walkControlFlow(std::vector<uint8_t> const& rom, std::set<unsigned int>& code, std::set<unsigned int>& leaders) {
+
+    std::vector<unsigned int> work{ START_ADDRESS };
+    leaders.insert(START_ADDRESS);
+
+    while (!work.empty()) {
+
+        unsigned int address = work.back();
+        work.pop_back();
+
+        uint16_t opcode;
+
+        if (code.count(address) || !fetch(rom, address, opcode)) {
+            continue;
+        }
+
+        code.insert(address);
+
+        unsigned int nnn = opcode & 0x0FFFu;
+
+        switch (instructionFlow(opcode)) {
+            case Flow::NEXT: {
+                work.push_back(address + 2);
+            } break;
+
+            case Flow::END: break;
+
+            case Flow::JUMP: {
+                leaders.insert(nnn);
+                work.push_back(nnn);
+            } break;
+
+            case Flow::CALL: {
+                leaders.insert(nnn);
+                leaders.insert(address + 2);
+                work.push_back(nnn);
+                work.push_back(address + 2);
+            } break;
+
+            case Flow::SKIP: {
+                leaders.insert(address + 2);
+                leaders.insert(address + 4);
+                work.push_back(address + 2);
+                work.push_back(address + 4);
+            } break;
+
+            case Flow::STOP: {
+                leaders.insert(address + 2);
+                work.push_back(address + 2);
+            } break;
+        }
+
+    }
+
+}
+
+
+
+
+//-------------CODE GENERATION------------
+
+std::string hex(unsigned int value, int digits) {
+    char text[16];
+    snprintf(text, sizeof(text), "0x%0*X", digits, value);
+    return text;
+}
+
+//Writes the C++ for one instruction. This mirrors the opcode functions in Chip8.cpp, including
+//counting down the timers after every instruction the way Chip8::Cycle() does. Anything that is
+//rare or touches the display is handed to the interpreter
+void emitInstruction(std::ostream& out, unsigned int address, uint16_t opcode) {
+
+    std::string x = hex((opcode & 0x0F00u) >> 8u, 1);
+    std::string y = hex((opcode & 0x00F0u) >> 4u, 1);
+    std::string kk = hex(opcode & 0x00FFu, 2);
+    std::string nnn = hex(opcode & 0x0FFFu, 3);
+    std::string next = hex(address + 2, 4);
+    std::string after = hex(address + 4, 4);
+    std::string interpret = "    rt.interpret(" + hex(address, 4) + ");\n";
+
+    out << "    //" << hex(address, 4) << ": " << hex(opcode, 4) << "\n";
+
+    switch (opcode >> 12u) {
+
+        case 0x0: {
+            if (opcode == 0x00EE) {
+                out << "    rt.SP = (rt.SP - 1) & 0x0Fu;\n    rt.tick();\n    return rt.stack[rt.SP];\n";
+                return;
+            }
+            if (opcode == 0x00E0) {
+                out << interpret;
+                return;
+            }
+        } break;
+
+        case 0x1: {
+            out << "    rt.tick();\n    return " << nnn << ";\n";
+        } return;
+
+        case 0x2: {
+            out << "    rt.stack[rt.SP] = " << next << ";\n    rt.SP = (rt.SP + 1) & 0x0Fu;\n    rt.tick();\n    return " << nnn << ";\n";
+        } return;
+
+        case 0x3: {
+            out << "    rt.tick();\n    return (rt.V[" << x << "] == " << kk << ") ? " << after << " : " << next << ";\n";
+        } return;
+
+        case 0x4: {
+            out << "    rt.tick();\n    return (rt.V[" << x << "] != " << kk << ") ? " << after << " : " << next << ";\n";
+        } return;
+
+        case 0x5: case 0x9: {
+            if ((opcode & 0x000Fu) == 0) {
+                char const* compare = (opcode >> 12u == 0x5) ? " == " : " != ";
+                out << "    rt.tick();\n    return (rt.V[" << x << "]" << compare << "rt.V[" << y << "]) ? " << after << " : " << next << ";\n";
+                return;
+            }
+        } break;
+
+        case 0x6: {
+            out << "    rt.V[" << x << "] = " << kk << ";\n";
+        } break;
+
+        case 0x7: {
+            out << "    rt.V[" << x << "] += " << kk << ";\n";
+        } break;
+
+        case 0x8: {
+            std::string vx = "rt.V[" + x + "]";
+            std::string vy = "rt.V[" + y + "]";
+
+            switch (opcode & 0x000Fu) {
+                case 0x0: out << "    " << vx << " = " << vy << ";\n"; break;
+                case 0x1: out << "    " << vx << " |= " << vy << ";\n"; break;
+                case 0x2: out << "    " << vx << " &= " << vy << ";\n"; break;
+                case 0x3: out << "    " << vx << " ^= " << vy << ";\n"; break;
+                case 0x4: out << "    { uint16_t sum = " << vx << " + " << vy << "; " << vx << " = sum & 0xFFu; rt.V[0xF] = (sum > 0xFFu) ? 1 : 0; }\n"; break;
+                case 0x5: out << "    { uint8_t valX = " << vx << ", valY = " << vy << "; " << vx << " = valX - valY; rt.V[0xF] = (valX > valY) ? 1 : 0; }\n"; break;
+                case 0x6: out << "    { uint8_t valX = " << vx << "; rt.V[0xF] = valX & 0x01u; " << vx << " >>= 1; }\n"; break;
+                case 0x7: out << "    { uint8_t valX = " << vx << ", valY = " << vy << "; " << vx << " = valY - valX; rt.V[0xF] = (valY > valX) ? 1 : 0; }\n"; break;
+                case 0xE: out << "    { uint8_t valX = " << vx << "; rt.V[0xF] = (valX & 0x80u) >> 7; " << vx << " <<= 1; }\n"; break;
+                default: break;
+            }
+        } break;
+
+        case 0xA: {
+            out << "    rt.I = " << nnn << ";\n";
+        } break;
+
+        case 0xB: {
+            out << "    rt.tick();\n    return " << nnn << " + rt.V[0x0];\n";
+        } return;
+
+        case 0xC: case 0xD: {
+            out << interpret;
+        } return;
+
+        case 0xE: {
+            out << interpret << "    return rt.PC;\n";
+        } return;
+
+        case 0xF: {
+            switch (opcode & 0x00FFu) {
+                case 0x07: out << "    rt.V[" << x << "] = rt.delayTimer;\n"; break;
+                case 0x15: out << "    rt.delayTimer = rt.V[" << x << "];\n"; break;
+                case 0x18: out << "    rt.soundTimer = rt.V[" << x << "];\n"; break;
+                case 0x1E: out << "    rt.I += rt.V[" << x << "];\n"; break;
+
+                case 0x0A: case 0x33: case 0x55: {
+                    out << interpret << "    return rt.PC;\n";
+                } return;
+
+                case 0x29: case 0x65: {
+                    out << interpret;
+                } return;
+
+                default: break;
+            }
+        } break;
+
+    }
+
+    out << "    rt.tick();\n";
+
+}
+
+//Writes one basic block as a function, returning its length in instructions
+unsigned int emitBlock(std::ostream& out, std::vector<uint8_t> const& rom, std::set<unsigned int> const& leaders, unsigned int start, unsigned int& length) {
+
+    out << "static uint16_t block_" << hex(start, 4) << "(StaticRuntime& rt) {\n";
+
+    unsigned int address = start;
+    unsigned int instructions = 0;
+    uint16_t opcode;
+
+    while (fetch(rom, address, opcode)) {
+
+        emitInstruction(out, address, opcode);
+        address += 2;
+        ++instructions;
+
+        if (instructionFlow(opcode) != Flow::NEXT) {
+            break;
+        }
+
+        //Falls through into the next block
+        if (leaders.count(address) || !fetch(rom, address, opcode)) {
+            out << "    return " << hex(address, 4) << ";\n";
+            break;
+        }
+
+    }
+
+    out << "}\n\n";
+
+    length = address - start;
+    return instructions;
+
+}
+
+
+
+
+int main(int argc, char** argv) {
+
+    if (argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " <ROM> <Output.cpp>\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    std::ifstream file(argv[1], std::ios::binary);
+
+    if (!file.is_open()) {
+        std::cerr << "Could not open " << argv[1] << "\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    std::vector<uint8_t> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    if (rom.size() > MEMORY_SIZE - START_ADDRESS) {
+        rom.resize(MEMORY_SIZE - START_ADDRESS);
+    }
+
+    std::set<unsigned int> code;
+    std::set<unsigned int> leaders;
+    walkControlFlow(rom, code, leaders);
+
+    std::ofstream out(argv[2]);
+
+    out << "//Generated by Recompiler from " << argv[1] << ", do not edit\n\n";
+    out << "#include <cstdint>\n\n#include \"StaticRuntime.hpp\"\n\n";
+
+    //Only addresses that really hold reachable code get a block, since jump targets may land past the end of the ROM
+    std::map<unsigned int, std::pair<unsigned int, unsigned int>> blocks; //Start address to length in bytes and instructions
+
+    for (unsigned int start : leaders) {
+        if (code.count(start)) {
+            unsigned int length;
+            unsigned int instructions = emitBlock(out, rom, leaders, start, length);
+            blocks[start] = std::make_pair(length, instructions);
+        }
+    }
+
+    out << "const StaticRuntime::Block STATIC_BLOCKS[] = {\n";
+    for (auto const& block : blocks) {
+        out << "    { " << hex(block.first, 4) << ", " << block.second.first << ", " << block.second.second << ", &block_" << hex(block.first, 4) << " },\n";
+    }
+    out << "    { 0x0000, 0, 0, nullptr } //Not a block, keeps the array from being empty\n";
+    out << "};\n\n";
+    out << "const unsigned int STATIC_BLOCK_COUNT = " << blocks.size() << ";\n\n";
+
+    //The original ROM, which the runtime compares blocks against to spot code changed at runtime
+    out << "const uint8_t STATIC_ROM_IMAGE[] = {";
+    for (unsigned int i = 0; i < rom.size(); ++i) {
+        out << ((i % 16 == 0) ? "\n    " : " ") << hex(rom[i], 2) << ",";
+    }
+    out << "\n    0x00 //Padding, keeps the array from being empty\n};\n\n";
+    out << "const unsigned int STATIC_ROM_SIZE = " << rom.size() << ";\n";
+
+    std::cout << "Translated " << code.size() << " instructions into " << blocks.size() << " blocks\n";
+
+    return 0;
+
+}
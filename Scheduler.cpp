@@ -0,0 +1,350 @@
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "Scheduler.hpp"
+
+
+
+
+//-------------SESSION COROUTINES------------
+
+//Why a session last suspended, which decides what wakes it up again
+enum class Reason : uint8_t {
+    FRAME, //Finished a frame, or has not started one yet
+    KEY, //Waiting in Fx0A for a key press
+    TIMER //Polling a running timer
+};
+
+//Where a session is, so a wake up only queues it when it is actually waiting for that
+enum class State : uint8_t {
+    READY,
+    WAIT_FRAME,
+    WAIT_KEY,
+    WAIT_TICK
+};
+
+//The coroutine type of a session. It starts suspended and never finishes, it is only destroyed
+struct SessionTask {
+
+    struct promise_type {
+        SessionTask get_return_object() { return SessionTask{ std::coroutine_handle<promise_type>::from_promise(*this) }; }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+
+};
+
+struct Session {
+
+    ~Session() {
+        if (task.handle) {
+            task.handle.destroy();
+        }
+    }
+
+    Chip8 machine;
+    SessionTask task{};
+    uint32_t pendingFrames{}; //Frames asked for but not run yet
+    bool realtime{};
+    Reason reason{Reason::FRAME};
+    State state{State::WAIT_FRAME};
+
+};
+
+//Suspends the session's coroutine, noting why for the lane to read
+struct Suspend {
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<>) noexcept { session.reason = reason; }
+    void await_resume() const noexcept {}
+
+    Session& session;
+    Reason reason;
+
+};
+
+//The body of every session: run a frame whenever one is pending, suspending whenever the ROM is
+//waiting on something. A cycle that hit Fx0A without a key has already rewound the program
+//counter, so the next cycle after waking retries it
+SessionTask runSession(Session& session) {
+
+    Chip8& machine = session.machine;
+
+    while (true) {
+
+        while (session.pendingFrames == 0) {
+            co_await Suspend{ session, Reason::FRAME };
+        }
+
+        for (unsigned int i = 0; i < Chip8::CYCLES_PER_FRAME; ++i) {
+
+            machine.Cycle();
+
+            if (machine.waiting() == Chip8::Wait::KEY) {
+                co_await Suspend{ session, Reason::KEY };
+            }
+            else if (machine.waiting() == Chip8::Wait::TIMER) {
+                co_await Suspend{ session, Reason::TIMER };
+            }
+
+        }
+
+        --session.pendingFrames;
+        co_await Suspend{ session, Reason::FRAME };
+
+    }
+
+}
+
+
+
+
+//-------------LANES------------
+
+//One scheduler thread and the sessions that live on it. Other threads only talk to a lane by
+//posting events to its inbox, so everything else in here is only touched by the lane's thread
+class Scheduler::Lane {
+
+    public:
+        Lane() {
+            thread = std::thread(&Lane::run, this);
+        }
+
+        ~Lane() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            wake.notify_one();
+            thread.join();
+        }
+
+        void post(std::function<void(Lane&)> event) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                inbox.push_back(std::move(event));
+            }
+            wake.notify_one();
+        }
+
+        void create(uint32_t id, std::vector<uint8_t> const& rom, bool realtime) {
+            std::unique_ptr<Session> session(new Session());
+            session->machine.loadROM(rom.data(), rom.size());
+            session->realtime = realtime;
+            session->task = runSession(*session);
+
+            park(id, *session);
+            sessions[id] = std::move(session);
+        }
+
+        void destroy(uint32_t id) {
+            sessions.erase(id); //Any queue entries left behind are skipped when their id is not found
+        }
+
+        void setKey(uint32_t id, uint8_t key, bool down) {
+            Session* session = find(id);
+
+            if (!session || key >= sizeof(session->machine.keys)) {
+                return;
+            }
+
+            session->machine.keys[key] = down ? 1 : 0;
+
+            if (down && session->state == State::WAIT_KEY) {
+                makeReady(id, *session);
+            }
+        }
+
+        void step(uint32_t id, uint32_t frames) {
+            Session* session = find(id);
+
+            if (!session) {
+                return;
+            }
+
+            session->pendingFrames += frames;
+
+            if (session->pendingFrames > 0 && session->state == State::WAIT_FRAME) {
+                makeReady(id, *session);
+            }
+        }
+
+        //Gives every realtime session waiting for the next tick a frame to run
+        void tick() {
+            std::vector<uint32_t> waiting;
+            waiting.swap(tickWaiters);
+
+            for (uint32_t id : waiting) {
+                Session* session = find(id);
+
+                if (session && session->state == State::WAIT_TICK) {
+                    ++session->pendingFrames;
+                    makeReady(id, *session);
+                }
+            }
+        }
+
+        void inspect(uint32_t id, std::function<void(Chip8 const&)> const& callback) {
+            Session* session = find(id);
+
+            if (session) {
+                callback(session->machine);
+            }
+        }
+
+    private:
+        Session* find(uint32_t id) {
+            auto session = sessions.find(id);
+            return (session == sessions.end()) ? nullptr : session->second.get();
+        }
+
+        void makeReady(uint32_t id, Session& session) {
+            session.state = State::READY;
+            ready.push_back(id);
+        }
+
+        //Files a suspended session under whatever will wake it
+        void park(uint32_t id, Session& session) {
+            switch (session.reason) {
+
+                case Reason::FRAME: {
+                    if (session.pendingFrames > 0) {
+                        makeReady(id, session);
+                    }
+                    else if (session.realtime) {
+                        session.state = State::WAIT_TICK;
+                        tickWaiters.push_back(id);
+                    }
+                    else {
+                        session.state = State::WAIT_FRAME;
+                    }
+                } break;
+
+                case Reason::KEY: {
+                    session.state = State::WAIT_KEY;
+                } break;
+
+                //The timers here count down every cycle rather than at 60 Hz, so the timer can
+                //run out before the next tick. Polling it only gives up the session's turn
+                case Reason::TIMER: {
+                    makeReady(id, session);
+                } break;
+
+            }
+        }
+
+        void run() {
+            while (true) {
+
+                std::deque<std::function<void(Lane&)>> events;
+
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    wake.wait(lock, [this] { return stopping || !inbox.empty() || !ready.empty(); });
+
+                    if (stopping) {
+                        return;
+                    }
+
+                    events.swap(inbox);
+                }
+
+                for (auto& event : events) {
+                    event(*this);
+                }
+
+                //Resumes every session that was ready at this point, then goes back for new events
+                for (size_t count = ready.size(); count > 0; --count) {
+
+                    uint32_t id = ready.front();
+                    ready.pop_front();
+
+                    Session* session = find(id);
+
+                    if (!session || session->state != State::READY) {
+                        continue;
+                    }
+
+                    session->task.handle.resume();
+                    park(id, *session);
+
+                }
+
+            }
+        }
+
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::deque<std::function<void(Lane&)>> inbox; //Guarded by mutex
+        bool stopping{}; //Guarded by mutex
+
+        std::unordered_map<uint32_t, std::unique_ptr<Session>> sessions;
+        std::deque<uint32_t> ready; //Sessions with work to do, in the order they got it
+        std::vector<uint32_t> tickWaiters; //Realtime sessions waiting for the next tick
+
+        std::thread thread; //Started last, once everything it uses is constructed
+
+};
+
+
+
+
+//-------------SCHEDULER------------
+
+Scheduler::Scheduler(unsigned int threads) {
+    if (threads == 0) {
+        threads = 1;
+    }
+
+    for (unsigned int i = 0; i < threads; ++i) {
+        lanes.emplace_back(new Lane());
+    }
+}
+
+Scheduler::~Scheduler() {}
+
+Scheduler::Lane& Scheduler::laneFor(uint32_t id) {
+    return *lanes[id % lanes.size()];
+}
+
+uint32_t Scheduler::createSession(std::vector<uint8_t> const& rom, bool realtime) {
+    uint32_t id = nextSession++;
+
+    laneFor(id).post([id, rom, realtime](Lane& lane) { lane.create(id, rom, realtime); });
+
+    return id;
+}
+
+void Scheduler::destroySession(uint32_t id) {
+    laneFor(id).post([id](Lane& lane) { lane.destroy(id); });
+}
+
+void Scheduler::setKey(uint32_t id, uint8_t key, bool down) {
+    laneFor(id).post([id, key, down](Lane& lane) { lane.setKey(id, key, down); });
+}
+
+void Scheduler::step(uint32_t id, uint32_t frames) {
+    laneFor(id).post([id, frames](Lane& lane) { lane.step(id, frames); });
+}
+
+void Scheduler::tick() {
+    for (auto& lane : lanes) {
+        lane->post([](Lane& lane) { lane.tick(); });
+    }
+}
+
+void Scheduler::inspect(uint32_t id, std::function<void(Chip8 const&)> callback) {
+    laneFor(id).post([id, callback](Lane& lane) { lane.inspect(id, callback); });
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "Chip8.hpp"
+
+//Cooperative scheduler for running huge numbers of mostly idle Chip8 sessions on a few threads
+//
+//Every session is a C++20 coroutine that runs its machine one frame at a time and suspends at
+//frame boundaries, while Fx0A waits for a key, and when it polls a running timer. A suspended
+//session is only resumed once it has work to do (frames requested by step(), a key press, or a
+//tick() for realtime sessions), so idle sessions cost nothing per frame. Sessions are spread
+//over the threads by id and never move, so a session is only touched by its own thread
+//
+//Needs C++20 for the coroutines
+class Scheduler {
+
+    public:
+        Scheduler(unsigned int threads);
+        ~Scheduler();
+
+        //Realtime sessions run one frame per tick(), others only run the frames step() asks for
+        uint32_t createSession(std::vector<uint8_t> const& rom, bool realtime);
+        void destroySession(uint32_t id);
+
+        void setKey(uint32_t id, uint8_t key, bool down);
+        void step(uint32_t id, uint32_t frames);
+        void tick(); //Call 60 times a second to drive the realtime sessions
+
+        //Runs the callback on the session's thread, between frames or waits, to read its machine
+        void inspect(uint32_t id, std::function<void(Chip8 const&)> callback);
+
+    private:
+        class Lane;
+
+        Lane& laneFor(uint32_t id);
+
+        std::vector<std::unique_ptr<Lane>> lanes;
+        std::atomic<uint32_t> nextSession{1};
+
+};
@@ -0,0 +1,578 @@
+#include <algorithm>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "Chip8.hpp"
+#include "InstancePool.hpp"
+#include "Protocol.hpp"
+
+//Emulator server which hosts many Chip8 sessions in one process
+//
+//Clients connect over a Unix domain socket and speak the binary protocol in Protocol.hpp. One
+//thread runs an epoll loop that accepts connections and reads requests, and hands each request
+//to the worker thread that owns its session. A session always lives on the same worker, so its
+//machine is only ever touched by one thread and needs no locking. Sessions outlive the connection
+//that created them, until a DESTROY request. Each worker is pinned to a NUMA node and keeps its
+//machines in a pool on that node
+//
+//Workers never wait on a client. Replies that do not fit in the socket are queued on the
+//connection and written by the event loop when the socket has room. A connection only has so
+//many requests in flight, and the event loop stops reading it until some are answered, so a
+//client that does not read its replies only holds up itself
+
+
+
+
+const uint32_t SESSIONS_PER_WORKER = 16384; //Size of each worker's machine pool, which is only address space until used
+const uint32_t MAX_PENDING = 256; //Requests a connection may have read but not answered, which bounds its queued replies
+
+//ROMs the server can create sessions from, keyed by their hash. Filled in before any thread starts, then only read
+std::unordered_map<uint64_t, std::vector<uint8_t>> roms;
+
+//A client connection. Worker threads write replies to it, so writes are serialised by a mutex.
+//The socket is closed once the event loop and every queued request have let go of it
+struct Connection {
+
+    Connection(int fd, int epoll) : fd(fd), epoll(epoll) {}
+    ~Connection() { close(fd); }
+
+    int fd;
+    int epoll; //The event loop's, to change which events it waits for on this connection
+    std::vector<uint8_t> input; //Bytes read but not yet making up a whole request
+
+    std::mutex writeMutex;
+    std::vector<uint8_t> output; //Reply bytes the socket had no room for, guarded by writeMutex
+    uint32_t pending{}; //Requests handed to workers and not yet answered, guarded by writeMutex
+    uint32_t events = EPOLLIN | EPOLLRDHUP; //What the event loop waits for, guarded by writeMutex
+    bool watched = true; //In the event loop's epoll set, guarded by writeMutex
+    bool dropped{}; //The event loop has let go of it, so it must not be watched again. Guarded by writeMutex
+
+};
+
+//One request waiting for a worker
+struct Job {
+    std::shared_ptr<Connection> connection;
+    Protocol::RequestHeader header;
+    std::vector<uint8_t> payload;
+};
+
+//Waits for requests and hangups while there is room for more requests in flight, and for room in
+//the socket while output is queued. Called with writeMutex held
+//
+//A connection with nothing to wait for is taken out of the epoll set altogether, since epoll
+//reports a hangup whatever the mask, and a paused connection cannot act on one. The reply that
+//makes room for more requests puts it back
+void updateEvents(Connection& connection) {
+    uint32_t events = 0;
+
+    if (connection.pending < MAX_PENDING) {
+        events |= EPOLLIN | EPOLLRDHUP;
+    }
+    if (!connection.output.empty()) {
+        events |= EPOLLOUT;
+    }
+
+    if (connection.dropped || (events == connection.events && connection.watched == (events != 0))) {
+        return;
+    }
+
+    epoll_event event{};
+    event.events = events;
+    event.data.fd = connection.fd;
+    connection.events = events;
+
+    if (events == 0) {
+        epoll_ctl(connection.epoll, EPOLL_CTL_DEL, connection.fd, nullptr);
+        connection.watched = false;
+    }
+    else {
+        epoll_ctl(connection.epoll, connection.watched ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, connection.fd, &event);
+        connection.watched = true;
+    }
+}
+
+//Writes as much queued output as the socket takes. Called by the event loop on EPOLLOUT
+void flushOutput(Connection& connection) {
+
+    std::lock_guard<std::mutex> lock(connection.writeMutex);
+
+    size_t offset = 0;
+
+    while (offset < connection.output.size()) {
+        ssize_t written = write(connection.fd, connection.output.data() + offset, connection.output.size() - offset);
+
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                offset = connection.output.size(); //The client has gone, so nothing queued can be delivered
+            }
+            break;
+        }
+
+        offset += written;
+    }
+
+    connection.output.erase(connection.output.begin(), connection.output.begin() + offset);
+    updateEvents(connection);
+
+}
+
+
+
+
+//Sends a reply without waiting. Whatever the socket has no room for is queued for the event loop
+void sendReply(Connection& connection, Protocol::RequestHeader const& request, uint8_t status, void const* payload, uint32_t length) {
+
+    Protocol::ReplyHeader reply{};
+    reply.type = request.type;
+    reply.status = status;
+    reply.session = request.session;
+    reply.tag = request.tag;
+    reply.length = length;
+
+    iovec parts[2] = {
+        { &reply, sizeof(reply) },
+        { const_cast<void*>(payload), length }
+    };
+    iovec* part = parts;
+    int count = (length > 0) ? 2 : 1;
+
+    std::lock_guard<std::mutex> lock(connection.writeMutex);
+
+    --connection.pending;
+
+    //Earlier replies still queued go first, so this one joins the back of the queue
+    while (count > 0 && connection.output.empty()) {
+
+        ssize_t written = writev(connection.fd, part, count);
+
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                count = 0; //The client has gone, the event loop will notice and drop the connection
+            }
+            break;
+        }
+
+        //Moves past whatever was written, which may end partway through a part
+        while (count > 0 && static_cast<size_t>(written) >= part->iov_len) {
+            written -= part->iov_len;
+            ++part;
+            --count;
+        }
+        if (count > 0) {
+            part->iov_base = static_cast<uint8_t*>(part->iov_base) + written;
+            part->iov_len -= written;
+        }
+
+    }
+
+    for (int i = 0; i < count; ++i) {
+        uint8_t const* bytes = static_cast<uint8_t const*>(part[i].iov_base);
+        connection.output.insert(connection.output.end(), bytes, bytes + part[i].iov_len);
+    }
+
+    updateEvents(connection);
+
+}
+
+
+
+
+//A worker thread and the sessions it owns
+class Worker {
+
+    public:
+        void start(unsigned int node) {
+            thread = std::thread(&Worker::run, this, node);
+        }
+
+        void post(Job&& job) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                jobs.push_back(std::move(job));
+            }
+            ready.notify_one();
+        }
+
+    private:
+        //The pool is made after pinning, so its pages are first touched on the right node
+        void run(unsigned int node) {
+            Numa::pinThread(node);
+            pool.reset(new InstancePool<Chip8>(SESSIONS_PER_WORKER, node));
+
+            //Neither failure stops the worker, they only cost speed
+            if (!pool->usesHugePages()) {
+                std::cerr << "Worker on node " << node << " has no huge pages for its machines\n";
+            }
+            if (!pool->boundToNode()) {
+                std::cerr << "Worker on node " << node << " could not bind its machines to the node\n";
+            }
+
+            while (true) {
+                Job job;
+
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    ready.wait(lock, [this] { return !jobs.empty(); });
+                    job = std::move(jobs.front());
+                    jobs.pop_front();
+                }
+
+                handle(job);
+            }
+        }
+
+        void handle(Job& job) {
+
+            Protocol::RequestHeader const& request = job.header;
+            Connection& connection = *job.connection;
+
+            if (request.type == Protocol::CREATE) {
+                uint64_t hash;
+
+                if (job.payload.size() != sizeof(hash)) {
+                    sendReply(connection, request, Protocol::BAD_REQUEST, nullptr, 0);
+                    return;
+                }
+
+                memcpy(&hash, job.payload.data(), sizeof(hash));
+                auto rom = roms.find(hash);
+
+                if (rom == roms.end()) {
+                    sendReply(connection, request, Protocol::UNKNOWN_ROM, nullptr, 0);
+                    return;
+                }
+
+                Chip8* machine = pool->create();
+
+                if (!machine) {
+                    sendReply(connection, request, Protocol::SERVER_FULL, nullptr, 0);
+                    return;
+                }
+
+                machine->loadROM(rom->second.data(), rom->second.size());
+                sessions[request.session] = machine;
+
+                sendReply(connection, request, Protocol::OK, nullptr, 0);
+                return;
+            }
+
+            auto session = sessions.find(request.session);
+
+            if (session == sessions.end()) {
+                sendReply(connection, request, Protocol::UNKNOWN_SESSION, nullptr, 0);
+                return;
+            }
+
+            Chip8& machine = *session->second;
+
+            switch (request.type) {
+
+                case Protocol::DESTROY: {
+                    pool->destroy(session->second);
+                    sessions.erase(session);
+                    sendReply(connection, request, Protocol::OK, nullptr, 0);
+                } break;
+
+                case Protocol::KEYS: {
+                    uint16_t keys;
+
+                    if (job.payload.size() != sizeof(keys)) {
+                        sendReply(connection, request, Protocol::BAD_REQUEST, nullptr, 0);
+                        break;
+                    }
+
+                    memcpy(&keys, job.payload.data(), sizeof(keys));
+
+                    for (unsigned int i = 0; i < sizeof(machine.keys); ++i) {
+                        machine.keys[i] = (keys >> i) & 0x01u;
+                    }
+
+                    sendReply(connection, request, Protocol::OK, nullptr, 0);
+                } break;
+
+                case Protocol::STEP: {
+                    uint32_t frames;
+
+                    if (job.payload.size() != sizeof(frames)) {
+                        sendReply(connection, request, Protocol::BAD_REQUEST, nullptr, 0);
+                        break;
+                    }
+
+                    memcpy(&frames, job.payload.data(), sizeof(frames));
+
+                    for (uint32_t i = 0; i < frames; ++i) {
+                        machine.Frame();
+                    }
+
+                    sendReply(connection, request, Protocol::OK, nullptr, 0);
+                } break;
+
+                case Protocol::FRAME: {
+                    sendReply(connection, request, Protocol::OK, machine.display, sizeof(machine.display));
+                } break;
+
+                case Protocol::SNAPSHOT: {
+                    Chip8::Snapshot state = machine.snapshot();
+                    sendReply(connection, request, Protocol::OK, &state, sizeof(state));
+                } break;
+
+                default: {
+                    sendReply(connection, request, Protocol::BAD_REQUEST, nullptr, 0);
+                } break;
+
+            }
+
+        }
+
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable ready;
+        std::deque<Job> jobs;
+
+        std::unique_ptr<InstancePool<Chip8>> pool; //Only touched by this worker's thread
+        std::unordered_map<uint32_t, Chip8*> sessions; //Only touched by this worker's thread
+
+};
+
+
+
+
+//Loads every file in the directory as a ROM, printing the hash clients need to ask for it
+void loadROMs(char const* directory) {
+
+    DIR* dir = opendir(directory);
+
+    if (!dir) {
+        std::cerr << "Could not open ROM directory " << directory << "\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    while (dirent* entry = readdir(dir)) {
+
+        std::string path = std::string(directory) + "/" + entry->d_name;
+        std::ifstream file(path, std::ios::binary);
+
+        if (entry->d_name[0] == '.' || !file.is_open()) {
+            continue;
+        }
+
+        std::vector<uint8_t> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        if (rom.empty()) {
+            continue;
+        }
+
+        uint64_t hash = Protocol::romHash(rom.data(), rom.size());
+        std::cout << std::hex << hash << std::dec << " " << entry->d_name << "\n";
+        roms[hash] = std::move(rom);
+
+    }
+
+    closedir(dir);
+
+}
+
+//Reads what is waiting on a connection and hands out each complete request, up to MAX_PENDING in
+//flight. Returns false once the connection should be dropped
+bool readRequests(std::shared_ptr<Connection> const& connection, std::vector<Worker>& workers, uint32_t& nextSession) {
+
+    uint8_t buffer[64 * 1024];
+    std::vector<uint8_t>& input = connection->input;
+
+    while (true) {
+
+        //Every request is at least a header, so reading no more than this many headers' worth
+        //can never complete more requests than there is room for
+        size_t room;
+        {
+            std::lock_guard<std::mutex> lock(connection->writeMutex);
+            room = MAX_PENDING - connection->pending;
+
+            if (room == 0) {
+                updateEvents(*connection);
+                return true;
+            }
+        }
+
+        ssize_t received = read(connection->fd, buffer, std::min(sizeof(buffer), room * sizeof(Protocol::RequestHeader)));
+
+        if (received == 0) {
+            return false;
+        }
+        if (received < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+
+        input.insert(input.end(), buffer, buffer + received);
+        size_t offset = 0;
+
+        while (input.size() - offset >= sizeof(Protocol::RequestHeader)) {
+
+            Job job;
+            job.connection = connection;
+            memcpy(&job.header, &input[offset], sizeof(job.header));
+
+            if (job.header.length > Protocol::MAX_PAYLOAD) {
+                return false;
+            }
+            if (input.size() - offset < sizeof(job.header) + job.header.length) {
+                break;
+            }
+
+            uint8_t const* payload = &input[offset + sizeof(job.header)];
+            job.payload.assign(payload, payload + job.header.length);
+            offset += sizeof(job.header) + job.header.length;
+
+            //New sessions are spread over the workers, and the id says which worker a session lives on
+            if (job.header.type == Protocol::CREATE) {
+                job.header.session = nextSession++;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(connection->writeMutex);
+                ++connection->pending;
+            }
+
+            workers[job.header.session % workers.size()].post(std::move(job));
+
+        }
+
+        input.erase(input.begin(), input.begin() + offset);
+
+    }
+
+}
+
+
+
+
+int main(int argc, char** argv) {
+
+    if (argc != 3 && argc != 4) {
+        std::cerr << "Usage: " << argv[0] << " <SocketPath> <ROMDirectory> [Threads]\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    char const* socketPath = argv[1];
+    unsigned int threads = (argc == 4) ? std::atoi(argv[3]) : std::thread::hardware_concurrency();
+
+    if (threads == 0) {
+        threads = 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN); //Writing to a client that has gone should fail, not kill the server
+
+    loadROMs(argv[2]);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socketPath, sizeof(address.sun_path) - 1);
+    unlink(socketPath);
+
+    if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(listener, SOMAXCONN) < 0) {
+        std::cerr << "Could not listen on " << socketPath << ": " << strerror(errno) << "\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    unsigned int nodes = Numa::nodeCount();
+
+    std::cout << "Listening on " << socketPath << " with " << threads << " worker threads on " << nodes << " NUMA nodes" << std::endl;
+
+    //Workers are spread over the nodes in turn
+    std::vector<Worker> workers(threads);
+    for (unsigned int i = 0; i < threads; ++i) {
+        workers[i].start(i % nodes);
+    }
+
+    int epoll = epoll_create1(EPOLL_CLOEXEC);
+
+    epoll_event listenEvent{};
+    listenEvent.events = EPOLLIN;
+    listenEvent.data.fd = listener;
+    epoll_ctl(epoll, EPOLL_CTL_ADD, listener, &listenEvent);
+
+    std::unordered_map<int, std::shared_ptr<Connection>> connections;
+    uint32_t nextSession = 1;
+
+    epoll_event events[256];
+
+    //Keeps serving until the process is killed
+    while (true) {
+
+        int count = epoll_wait(epoll, events, sizeof(events) / sizeof(events[0]), -1);
+
+        for (int i = 0; i < count; ++i) {
+
+            int fd = events[i].data.fd;
+
+            if (fd == listener) {
+                int client;
+
+                while ((client = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                    epoll_event clientEvent{};
+                    clientEvent.events = EPOLLIN | EPOLLRDHUP;
+                    clientEvent.data.fd = client;
+                    epoll_ctl(epoll, EPOLL_CTL_ADD, client, &clientEvent);
+                    connections[client] = std::make_shared<Connection>(client, epoll);
+                }
+
+                continue;
+            }
+
+            auto connection = connections.find(fd);
+
+            if (connection == connections.end()) {
+                continue;
+            }
+
+            if (events[i].events & EPOLLOUT) {
+                flushOutput(*connection->second);
+            }
+
+            if ((events[i].events & ~EPOLLOUT) && !readRequests(connection->second, workers, nextSession)) {
+                {
+                    std::lock_guard<std::mutex> lock(connection->second->writeMutex);
+                    connection->second->dropped = true;
+                }
+
+                epoll_ctl(epoll, EPOLL_CTL_DEL, fd, nullptr);
+                connections.erase(connection);
+            }
+
+        }
+
+    }
+
+    return 0;
+
+}
@@ -0,0 +1,74 @@
+#include <cstdint>
+#include <cstring>
+
+#include "StaticRuntime.hpp"
+
+//Starting address of the memory where the ROM file is stored, which is where translated code starts
+const unsigned int START_ADDRESS = 0x200;
+
+
+
+
+//Runtime constructor which points the translated code at the machine's state and
+//indexes the generated blocks by their starting address
+StaticRuntime::StaticRuntime(Chip8& machine)
+    : machine(machine),
+      V(machine.registers),
+      memory(machine.memory),
+      keys(machine.keys),
+      I(machine.indexRegister),
+      PC(machine.programCounter),
+      stack(machine.stack),
+      SP(machine.stackPointer),
+      delayTimer(machine.delayTimer),
+      soundTimer(machine.soundTimer)
+{
+
+    for (unsigned int i = 0; i < STATIC_BLOCK_COUNT; ++i) {
+        blocks[STATIC_BLOCKS[i].address & (Chip8::MEMORY_SIZE - 1)] = &STATIC_BLOCKS[i];
+    }
+
+}
+
+//Counts down the timers, the same way the end of Chip8::Cycle() does
+void StaticRuntime::tick() {
+    if (delayTimer > 0) {
+        --delayTimer;
+    }
+    if (soundTimer > 0) {
+        --soundTimer;
+    }
+}
+
+//Runs one instruction through the interpreter, used for instructions the Recompiler leaves alone
+//(drawing, random numbers, waiting for keys, memory stores)
+void StaticRuntime::interpret(uint16_t address) {
+    PC = address;
+    machine.Cycle();
+}
+
+//A block can only be trusted if the ROM has not overwritten its code since it was translated
+bool StaticRuntime::unchanged(Block const* block) const {
+    return memcmp(&memory[block->address], &STATIC_ROM_IMAGE[block->address - START_ADDRESS], block->length) == 0;
+}
+
+//Runs translated blocks while the program counter lands on one, and the interpreter otherwise
+//A block is only run if it fits in the remaining cycles, so run(n) always does exactly n cycles
+void StaticRuntime::run(unsigned int cycles) {
+
+    while (cycles > 0) {
+
+        Block const* block = blocks[PC & (Chip8::MEMORY_SIZE - 1)];
+
+        if (block && block->instructions <= cycles && unchanged(block)) {
+            PC = block->function(*this);
+            cycles -= block->instructions;
+        }
+        else {
+            machine.Cycle();
+            --cycles;
+        }
+
+    }
+
+}
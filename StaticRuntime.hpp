@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Chip8.hpp"
+
+//Runtime for ROMs translated ahead of time into C++ by the Recompiler
+//Each reachable basic block of the ROM becomes a function which works directly on the Chip8 state
+//and returns the address of the next block. Anything the Recompiler could not translate, or code
+//that was changed at runtime, is run by the normal interpreter instead
+class StaticRuntime {
+
+    public:
+        typedef uint16_t (*BlockFunc)(StaticRuntime& rt); //A translated basic block, returning the address to continue at
+
+        struct Block {
+            uint16_t address; //Address of the first instruction
+            uint16_t length; //Length of the block in bytes
+            uint16_t instructions; //Number of instructions, which is how many cycles the block takes
+            BlockFunc function;
+        };
+
+        StaticRuntime(Chip8& machine);
+
+        void run(unsigned int cycles); //Runs the given number of cycles, the same as calling Cycle() that many times
+        void tick(); //Counts down the timers, which the interpreter does once per instruction
+        void interpret(uint16_t address); //Runs the single instruction at address through the interpreter
+
+        Chip8& machine;
+
+        //The machine state translated blocks read and write
+        uint8_t* V;
+        uint8_t* memory;
+        uint8_t* keys;
+        uint16_t& I;
+        uint16_t& PC;
+        uint16_t* stack;
+        uint8_t& SP;
+        uint8_t& delayTimer;
+        uint8_t& soundTimer;
+
+    private:
+        bool unchanged(Block const* block) const; //Checks if the block's code in memory still matches the ROM it was translated from
+
+        Block const* blocks[Chip8::MEMORY_SIZE]{}; //Translated block starting at each address, if any
+
+};
+
+//Defined by the translation unit the Recompiler generates for a ROM
+extern const StaticRuntime::Block STATIC_BLOCKS[];
+extern const unsigned int STATIC_BLOCK_COUNT;
+extern const uint8_t STATIC_ROM_IMAGE[];
+extern const unsigned int STATIC_ROM_SIZE;
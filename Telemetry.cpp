@@ -0,0 +1,261 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "Telemetry.hpp"
+
+namespace Telemetry {
+
+    //-------------METRIC NAMES------------
+
+    struct Description {
+        char const* name;
+        char const* help;
+        double scale; //Multiplies recorded values into the exported unit
+    };
+
+    const Description COUNTER_DESCRIPTIONS[COUNTERS] = {
+        { "chip8_frames_total", "Frames presented", 1.0 },
+        { "chip8_instructions_total", "Instructions executed", 1.0 },
+        { "chip8_late_frames_total", "Frames presented a whole frame or more late", 1.0 }
+    };
+
+    const Description DISTRIBUTION_DESCRIPTIONS[DISTRIBUTIONS] = {
+        { "chip8_instructions_per_frame", "Instructions executed per presented frame", 1.0 },
+        { "chip8_frame_seconds", "Host time between presents", 1e-9 },
+        { "chip8_present_seconds", "Time to render and present a frame", 1e-9 },
+        { "chip8_input_latency_seconds", "Time from reading a key change to the next present", 1e-9 },
+        { "chip8_cycle_seconds", "Time in Chip8::Cycle", 1e-9 },
+        { "chip8_process_input_seconds", "Time in Platform::ProcessInput", 1e-9 },
+        { "chip8_update_seconds", "Time in Platform::Update", 1e-9 }
+    };
+
+    //Histograms are exported with a bucket at every power of 2 up to this one
+    const unsigned int EXPORTED_POWERS = 36; //Over a minute in nanoseconds
+
+
+
+
+    //-------------THREADS------------
+
+    std::mutex registryMutex;
+    std::vector<std::unique_ptr<ThreadMetrics>> registry; //Guarded by registryMutex
+
+    //Only runs the first time a thread records anything
+    ThreadMetrics* registerThread() {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        registry.emplace_back(new ThreadMetrics());
+        return registry.back().get();
+    }
+
+    uint64_t Histogram::bucketLimit(unsigned int bucket) {
+        if (bucket < 2 * SUB_BUCKETS) {
+            return bucket;
+        }
+
+        unsigned int shift = bucket / SUB_BUCKETS - 1;
+        uint64_t sub = bucket % SUB_BUCKETS + SUB_BUCKETS;
+        return ((sub + 1) << shift) - 1; //Wraps to the largest value for the top bucket
+    }
+
+
+
+
+    //-------------EXPORT------------
+
+    std::string prometheusText() {
+
+        uint64_t counters[COUNTERS]{};
+        std::vector<uint64_t> buckets(DISTRIBUTIONS * Histogram::BUCKETS);
+        uint64_t sums[DISTRIBUTIONS]{};
+
+        {
+            std::lock_guard<std::mutex> lock(registryMutex);
+
+            for (auto const& metrics : registry) {
+                for (unsigned int i = 0; i < COUNTERS; ++i) {
+                    counters[i] += metrics->counters[i].load(std::memory_order_relaxed);
+                }
+                for (unsigned int i = 0; i < DISTRIBUTIONS; ++i) {
+                    Histogram const& histogram = metrics->distributions[i];
+
+                    for (unsigned int bucket = 0; bucket < Histogram::BUCKETS; ++bucket) {
+                        buckets[i * Histogram::BUCKETS + bucket] += histogram.buckets[bucket].load(std::memory_order_relaxed);
+                    }
+                    sums[i] += histogram.sum.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        std::ostringstream text;
+        text.precision(12); //Enough for the largest exported bucket edge to be written exactly
+
+        for (unsigned int i = 0; i < COUNTERS; ++i) {
+            Description const& description = COUNTER_DESCRIPTIONS[i];
+
+            text << "# HELP " << description.name << " " << description.help << "\n";
+            text << "# TYPE " << description.name << " counter\n";
+            text << description.name << " " << counters[i] << "\n";
+        }
+
+        //The fine buckets stay internal. Prometheus gets a fixed set of buckets, one for each power of
+        //2 up to 2^EXPORTED_POWERS, so every scrape and every process exports the same series and
+        //they can be aggregated. Powers of 2 fall on fine bucket edges, so each count is exact
+        for (unsigned int i = 0; i < DISTRIBUTIONS; ++i) {
+            Description const& description = DISTRIBUTION_DESCRIPTIONS[i];
+            uint64_t const* counts = &buckets[i * Histogram::BUCKETS];
+            uint64_t total = 0;
+            unsigned int bucket = 0;
+
+            text << "# HELP " << description.name << " " << description.help << "\n";
+            text << "# TYPE " << description.name << " histogram\n";
+
+            for (unsigned int power = 0; power <= EXPORTED_POWERS; ++power) {
+                uint64_t limit = (uint64_t{1} << power) - 1; //Values below 2^power
+
+                while (bucket < Histogram::BUCKETS && Histogram::bucketLimit(bucket) <= limit) {
+                    total += counts[bucket++];
+                }
+
+                text << description.name << "_bucket{le=\"" << limit * description.scale << "\"} " << total << "\n";
+            }
+
+            while (bucket < Histogram::BUCKETS) {
+                total += counts[bucket++];
+            }
+
+            text << description.name << "_bucket{le=\"+Inf\"} " << total << "\n";
+            text << description.name << "_sum " << sums[i] * description.scale << "\n";
+            text << description.name << "_count " << total << "\n";
+        }
+
+        return text.str();
+
+    }
+
+    void writeAll(int fd, std::string const& data) {
+        size_t written = 0;
+
+        while (written < data.size()) {
+            ssize_t result = write(fd, data.data() + written, data.size() - written);
+
+            if (result < 0 && errno == EINTR) {
+                continue;
+            }
+            if (result <= 0) {
+                return;
+            }
+
+            written += result;
+        }
+    }
+
+    //Reads the request up to the blank line that ends its headers. The request itself is ignored,
+    //every path gets the metrics. Clients are answered one at a time, so reads and writes time out
+    //after a second and a client that stalls is answered or dropped instead of holding up the rest
+    void answer(int client) {
+        timeval timeout{};
+        timeout.tv_sec = 1;
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        char request[4096];
+        size_t received = 0;
+
+        while (received < sizeof(request) - 1) {
+            ssize_t result = read(client, request + received, sizeof(request) - 1 - received);
+
+            if (result < 0 && errno == EINTR) {
+                continue;
+            }
+            if (result <= 0) {
+                break;
+            }
+
+            received += result;
+            request[received] = '\0';
+
+            if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n")) {
+                break;
+            }
+        }
+
+        std::string body = prometheusText();
+        std::string reply = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+
+        writeAll(client, reply);
+        close(client);
+    }
+
+    bool serve(char const* socketPath) {
+
+        int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, socketPath, sizeof(address.sun_path) - 1);
+        unlink(socketPath);
+
+        if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(listener, 16) < 0) {
+            if (listener >= 0) {
+                close(listener);
+            }
+            return false;
+        }
+
+        //Scrapes are rare and small, so one at a time is plenty
+        std::thread([listener] {
+            while (true) {
+                int client = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+
+                if (client >= 0) {
+                    answer(client);
+                }
+            }
+        }).detach();
+
+        return true;
+
+    }
+
+    void writeFile(char const* path, std::chrono::milliseconds interval) {
+
+        std::string target = path;
+
+        //Written to a temporary file and renamed over the old one, so readers never see half a file
+        std::thread([target, interval] {
+            std::string temporary = target + ".tmp";
+
+            while (true) {
+                std::this_thread::sleep_for(interval);
+
+                std::string text = prometheusText();
+                FILE* file = fopen(temporary.c_str(), "w");
+
+                if (!file) {
+                    continue;
+                }
+
+                fwrite(text.data(), 1, text.size(), file);
+                fclose(file);
+                rename(temporary.c_str(), target.c_str());
+            }
+        }).detach();
+
+    }
+
+}
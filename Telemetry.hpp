@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+//Runtime metrics for running emulators
+//
+//Every thread records into its own counters and histograms, so recording is a relaxed atomic
+//increment on memory no other thread writes. Readers add up every thread's metrics when they ask
+//for them. They come out as Prometheus text, either served over HTTP on a Unix socket or written
+//to a stats file every so often
+namespace Telemetry {
+
+    enum Counter : uint8_t {
+        FRAMES, //Frames presented
+        INSTRUCTIONS, //Instructions executed
+        LATE_FRAMES, //Frames presented a whole frame or more after they were due
+        COUNTERS
+    };
+
+    enum Distribution : uint8_t {
+        INSTRUCTIONS_PER_FRAME,
+        FRAME_TIME, //Host time between presents
+        PRESENT_TIME, //Rendering the display and handing it to the platform
+        INPUT_LATENCY, //From a key change being read to the next present
+        CYCLE_TIME, //Time in Chip8::Cycle()
+        INPUT_TIME, //Time in Platform::ProcessInput()
+        UPDATE_TIME, //Time in Platform::Update()
+        DISTRIBUTIONS
+    };
+
+    //Log-linear histogram in the style of HdrHistogram. Values below 32 get a bucket each, and
+    //above that every power of 2 is split into 16 buckets, so a value is known to within about 6%
+    //over the whole 64 bit range
+    class Histogram {
+
+        public:
+            static constexpr unsigned int SUB_BITS = 4;
+            static constexpr unsigned int SUB_BUCKETS = 1u << SUB_BITS;
+            static constexpr unsigned int BUCKETS = (64 - SUB_BITS) * SUB_BUCKETS + SUB_BUCKETS;
+
+            static unsigned int bucketOf(uint64_t value) {
+                if (value < 2 * SUB_BUCKETS) {
+                    return static_cast<unsigned int>(value);
+                }
+
+                unsigned int shift = 63 - __builtin_clzll(value) - SUB_BITS;
+                return shift * SUB_BUCKETS + static_cast<unsigned int>(value >> shift);
+            }
+
+            static uint64_t bucketLimit(unsigned int bucket); //The largest value that lands in the bucket
+
+            void record(uint64_t value) {
+                buckets[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+                sum.fetch_add(value, std::memory_order_relaxed);
+            }
+
+            std::atomic<uint64_t> buckets[BUCKETS]{};
+            std::atomic<uint64_t> sum{};
+
+    };
+
+    //One thread's metrics. They are never freed, so a thread that has finished still counts
+    struct ThreadMetrics {
+        std::atomic<uint64_t> counters[COUNTERS]{};
+        Histogram distributions[DISTRIBUTIONS];
+    };
+
+    ThreadMetrics* registerThread();
+
+    inline ThreadMetrics& local() {
+        static thread_local ThreadMetrics* metrics = registerThread();
+        return *metrics;
+    }
+
+    inline void count(Counter counter, uint64_t amount = 1) {
+        local().counters[counter].fetch_add(amount, std::memory_order_relaxed);
+    }
+
+    inline void record(Distribution distribution, uint64_t value) {
+        local().distributions[distribution].record(value);
+    }
+
+    inline void record(Distribution distribution, std::chrono::steady_clock::duration time) {
+        record(distribution, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(time).count()));
+    }
+
+    //Records how long the enclosing scope took
+    class ScopeTimer {
+
+        public:
+            explicit ScopeTimer(Distribution distribution) : distribution(distribution), start(std::chrono::steady_clock::now()) {}
+            ~ScopeTimer() { record(distribution, std::chrono::steady_clock::now() - start); }
+
+        private:
+            Distribution distribution;
+            std::chrono::steady_clock::time_point start;
+
+    };
+
+    std::string prometheusText(); //Every thread's metrics added up, in the Prometheus text format
+
+    //Exporters, each running on a background thread of its own for the rest of the process
+    bool serve(char const* socketPath); //Answers every HTTP request on the socket with the metrics
+    void writeFile(char const* path, std::chrono::milliseconds interval); //Replaces the file with the metrics every interval
+
+}
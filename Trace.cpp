@@ -0,0 +1,530 @@
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Trace.hpp"
+
+
+
+
+//-------------COMPRESSION------------
+
+//Block compression in the LZ4 block format: a token byte holding the literal and match lengths,
+//extra length bytes when either is 15 or more, the literals, then a 2 byte match offset. Matches
+//are found through a hash table of 4 byte sequences, trading ratio for speed like LZ4 does
+const unsigned int HASH_BITS = 12;
+const unsigned int MIN_MATCH = 4;
+const unsigned int LAST_LITERALS = 5; //The format ends every block with at least this many literals
+const unsigned int MATCH_LIMIT = 12; //No match may start this close to the end
+const unsigned int MAX_OFFSET = 65535;
+
+static uint32_t read32(uint8_t const* data) {
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static uint64_t read64(uint8_t const* data) {
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+//Length of the match between the two positions, compared 8 bytes at a time. The first differing
+//byte is found from the lowest set bit of the XOR, which is the first byte on little endian hosts
+static size_t matchLength(uint8_t const* in, size_t match, size_t position, size_t limit) {
+    size_t length = MIN_MATCH;
+
+    while (position + length + 8 <= limit) {
+        uint64_t difference = read64(in + match + length) ^ read64(in + position + length);
+
+        if (difference) {
+            return length + __builtin_ctzll(difference) / 8;
+        }
+
+        length += 8;
+    }
+
+    while (position + length < limit && in[match + length] == in[position + length]) {
+        ++length;
+    }
+
+    return length;
+}
+
+static void writeLength(std::vector<uint8_t>& out, size_t length) {
+    while (length >= 255) {
+        out.push_back(255);
+        length -= 255;
+    }
+    out.push_back(static_cast<uint8_t>(length));
+}
+
+static void writeSequence(std::vector<uint8_t>& out, uint8_t const* literals, size_t literalLength, size_t offset, size_t matchLength) {
+    uint8_t token = static_cast<uint8_t>(std::min<size_t>(literalLength, 15) << 4);
+
+    if (offset) {
+        token |= static_cast<uint8_t>(std::min<size_t>(matchLength - MIN_MATCH, 15));
+    }
+
+    out.push_back(token);
+
+    if (literalLength >= 15) {
+        writeLength(out, literalLength - 15);
+    }
+
+    out.insert(out.end(), literals, literals + literalLength);
+
+    if (offset) {
+        out.push_back(static_cast<uint8_t>(offset));
+        out.push_back(static_cast<uint8_t>(offset >> 8));
+
+        if (matchLength - MIN_MATCH >= 15) {
+            writeLength(out, matchLength - MIN_MATCH - 15);
+        }
+    }
+}
+
+static void compress(uint8_t const* in, size_t size, std::vector<uint8_t>& out) {
+    out.clear();
+
+    uint32_t table[1u << HASH_BITS] = {}; //Position + 1 of the last sequence with each hash, 0 for none
+    size_t anchor = 0;
+    size_t position = 0;
+    size_t misses = 0; //Since the last match. Like LZ4, data that keeps not matching is stepped through faster
+
+    while (size > MATCH_LIMIT && position < size - MATCH_LIMIT) {
+
+        uint32_t sequence = read32(in + position);
+        uint32_t hash = (sequence * 2654435761u) >> (32 - HASH_BITS);
+        size_t candidate = table[hash];
+        table[hash] = static_cast<uint32_t>(position + 1);
+
+        if (candidate == 0 || position - (candidate - 1) > MAX_OFFSET || read32(in + candidate - 1) != sequence) {
+            position += 1 + (misses++ >> 6);
+            continue;
+        }
+
+        size_t match = candidate - 1;
+        size_t length = matchLength(in, match, position, size - LAST_LITERALS);
+
+        writeSequence(out, in + anchor, position - anchor, position - match, length);
+
+        position += length;
+        anchor = position;
+        misses = 0;
+
+    }
+
+    writeSequence(out, in + anchor, size - anchor, 0, 0);
+}
+
+//Returns false for corrupt input rather than reading or writing out of bounds
+static bool decompress(uint8_t const* in, size_t size, uint8_t* out, size_t outSize) {
+    size_t inPosition = 0;
+    size_t outPosition = 0;
+
+    while (inPosition < size) {
+
+        uint8_t token = in[inPosition++];
+        size_t literalLength = token >> 4;
+
+        if (literalLength == 15) {
+            uint8_t extra;
+            do {
+                if (inPosition >= size) {
+                    return false;
+                }
+                extra = in[inPosition++];
+                literalLength += extra;
+            } while (extra == 255);
+        }
+
+        if (literalLength > size - inPosition || literalLength > outSize - outPosition) {
+            return false;
+        }
+
+        memcpy(out + outPosition, in + inPosition, literalLength);
+        inPosition += literalLength;
+        outPosition += literalLength;
+
+        //The last sequence has no match
+        if (inPosition == size) {
+            break;
+        }
+
+        if (size - inPosition < 2) {
+            return false;
+        }
+
+        size_t offset = in[inPosition] | (in[inPosition + 1] << 8);
+        inPosition += 2;
+
+        size_t matchLength = (token & 0x0Fu) + MIN_MATCH;
+
+        if ((token & 0x0Fu) == 15) {
+            uint8_t extra;
+            do {
+                if (inPosition >= size) {
+                    return false;
+                }
+                extra = in[inPosition++];
+                matchLength += extra;
+            } while (extra == 255);
+        }
+
+        if (offset == 0 || offset > outPosition || matchLength > outSize - outPosition) {
+            return false;
+        }
+
+        //Byte by byte, since a match may overlap the bytes it is producing
+        for (size_t i = 0; i < matchLength; ++i, ++outPosition) {
+            out[outPosition] = out[outPosition - offset];
+        }
+
+    }
+
+    return outPosition == outSize;
+}
+
+
+
+
+//-------------DELTA ENCODING------------
+
+//Records are split into 8 byte planes before compressing: program counter deltas (low then high
+//byte), opcode (high then low), info, value, and write address deltas (low then high). Straight
+//line code has a delta of 2 almost everywhere, so each plane is long runs the compressor shrinks
+//well. Deltas restart at 0 in every block, so blocks decode on their own
+static void encodeColumns(TraceRecord const* records, size_t count, std::vector<uint8_t>& columns) {
+    columns.resize(count * sizeof(TraceRecord));
+
+    uint8_t* planes[8];
+    for (unsigned int i = 0; i < 8; ++i) {
+        planes[i] = columns.data() + i * count;
+    }
+
+    uint16_t lastPC = 0;
+    uint16_t lastWrite = 0;
+
+    //The record is copied out first, since stores through the byte pointers could otherwise alias it
+    for (size_t i = 0; i < count; ++i) {
+        TraceRecord record = records[i];
+
+        bool instruction = !(record.info & TRACE_NO_INSTRUCTION);
+        bool write = record.info & TRACE_WRITE;
+
+        uint16_t pcDelta = instruction ? static_cast<uint16_t>(record.programCounter - lastPC) : 0;
+        uint16_t writeDelta = write ? static_cast<uint16_t>(record.writeAddress - lastWrite) : 0;
+
+        planes[0][i] = static_cast<uint8_t>(pcDelta);
+        planes[1][i] = static_cast<uint8_t>(pcDelta >> 8);
+        planes[2][i] = static_cast<uint8_t>(record.opcode >> 8);
+        planes[3][i] = static_cast<uint8_t>(record.opcode);
+        planes[4][i] = record.info;
+        planes[5][i] = (record.info & TRACE_REGISTER) ? record.value : 0;
+        planes[6][i] = static_cast<uint8_t>(writeDelta);
+        planes[7][i] = static_cast<uint8_t>(writeDelta >> 8);
+
+        lastPC = instruction ? record.programCounter : lastPC;
+        lastWrite = write ? record.writeAddress : lastWrite;
+    }
+}
+
+static void decodeColumns(std::vector<uint8_t> const& columns, size_t count, std::vector<TraceRecord>& records) {
+    records.resize(count);
+
+    uint8_t const* planes[8];
+    for (unsigned int i = 0; i < 8; ++i) {
+        planes[i] = columns.data() + i * count;
+    }
+
+    uint16_t lastPC = 0;
+    uint16_t lastWrite = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        TraceRecord& record = records[i];
+
+        record.info = planes[4][i];
+        record.programCounter = (record.info & TRACE_NO_INSTRUCTION) ? 0 : static_cast<uint16_t>(lastPC + (planes[0][i] | (planes[1][i] << 8)));
+        record.opcode = (planes[2][i] << 8) | planes[3][i];
+        record.value = planes[5][i];
+        record.writeAddress = (record.info & TRACE_WRITE) ? static_cast<uint16_t>(lastWrite + (planes[6][i] | (planes[7][i] << 8))) : 0;
+
+        if (!(record.info & TRACE_NO_INSTRUCTION)) {
+            lastPC = record.programCounter;
+        }
+        if (record.info & TRACE_WRITE) {
+            lastWrite = record.writeAddress;
+        }
+    }
+}
+
+
+
+
+//-------------WRITER------------
+
+TraceWriter::TraceWriter(char const* path) {
+    file = fopen(path, "wb");
+
+    if (!file) {
+        return;
+    }
+
+    TraceFormat::FileHeader header{};
+    memcpy(header.magic, "C8TRACE", 8);
+    header.version = TraceFormat::VERSION;
+    header.recordSize = sizeof(TraceRecord);
+    fwrite(&header, sizeof(header), 1, file);
+
+    thread = std::thread(&TraceWriter::run, this);
+}
+
+TraceWriter::~TraceWriter() {
+    close();
+
+    for (TraceRecord* records : spare) {
+        delete[] records;
+    }
+}
+
+uint32_t TraceWriter::newStream() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return streams++;
+}
+
+//Machines only wait here when the writer has fallen MAX_QUEUED buffers behind, so records are
+//never dropped
+TraceRecord* TraceWriter::exchange(uint32_t stream, TraceRecord* records, size_t count) {
+    if (records) {
+        finish(stream, records, count);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (spare.empty()) {
+        return new TraceRecord[TraceHooks::BUFFER_RECORDS];
+    }
+
+    TraceRecord* empty = spare.back();
+    spare.pop_back();
+    return empty;
+}
+
+void TraceWriter::finish(uint32_t stream, TraceRecord* records, size_t count) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    changed.wait(lock, [this] { return queue.size() < MAX_QUEUED || closing; });
+    queue.push_back(Job{ stream, records, count });
+    changed.notify_all();
+}
+
+void TraceWriter::run() {
+    while (true) {
+
+        Job job;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [this] { return closing || !queue.empty(); });
+
+            if (queue.empty()) {
+                return; //Closing, and everything has been written
+            }
+
+            job = queue.front();
+            queue.pop_front();
+            changed.notify_all();
+        }
+
+        if (job.count > 0) {
+            writeBlock(job);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        spare.push_back(job.records);
+
+    }
+}
+
+void TraceWriter::writeBlock(Job const& job) {
+
+    if (job.stream >= streamRecords.size()) {
+        streamRecords.resize(job.stream + 1);
+        streamFrames.resize(job.stream + 1);
+    }
+
+    encodeColumns(job.records, job.count, columns);
+    compress(columns.data(), columns.size(), compressed);
+
+    TraceFormat::BlockHeader header{};
+    header.stream = job.stream;
+    header.records = static_cast<uint32_t>(job.count);
+    header.compressedSize = static_cast<uint32_t>(compressed.size());
+    header.firstRecord = streamRecords[job.stream];
+
+    TraceFormat::BlockEntry entry{};
+    entry.offset = static_cast<uint64_t>(ftello(file));
+    entry.firstRecord = header.firstRecord;
+    entry.firstFrame = streamFrames[job.stream];
+    entry.stream = job.stream;
+    entry.records = header.records;
+
+    for (size_t i = 0; i < job.count; ++i) {
+        if (job.records[i].info & TRACE_FRAME) {
+            ++entry.frames;
+        }
+    }
+
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(compressed.data(), 1, compressed.size(), file);
+
+    blocks.push_back(entry);
+    streamRecords[job.stream] += job.count;
+    streamFrames[job.stream] += entry.frames;
+
+}
+
+void TraceWriter::close() {
+    if (!file) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+    }
+    changed.notify_all();
+    thread.join();
+
+    TraceFormat::Trailer trailer{};
+    trailer.indexOffset = static_cast<uint64_t>(ftello(file));
+    trailer.blockCount = blocks.size();
+    memcpy(trailer.magic, "C8INDEX", 8);
+
+    fwrite(blocks.data(), sizeof(blocks[0]), blocks.size(), file);
+    fwrite(&trailer, sizeof(trailer), 1, file);
+
+    fclose(file);
+    file = nullptr;
+}
+
+
+
+
+//-------------READER------------
+
+bool TraceReader::open(char const* path) {
+    file.open(path, std::ios::binary);
+
+    TraceFormat::FileHeader header{};
+    TraceFormat::Trailer trailer{};
+
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    file.seekg(-static_cast<std::streamoff>(sizeof(trailer)), std::ios::end);
+    file.read(reinterpret_cast<char*>(&trailer), sizeof(trailer));
+
+    if (!file || memcmp(header.magic, "C8TRACE", 8) != 0 || memcmp(trailer.magic, "C8INDEX", 8) != 0 ||
+        header.version != TraceFormat::VERSION || header.recordSize != sizeof(TraceRecord)) {
+        return false;
+    }
+
+    blockIndex.resize(trailer.blockCount);
+
+    file.seekg(trailer.indexOffset);
+    file.read(reinterpret_cast<char*>(blockIndex.data()), blockIndex.size() * sizeof(blockIndex[0]));
+
+    return static_cast<bool>(file);
+}
+
+bool TraceReader::readBlock(size_t block, std::vector<TraceRecord>& records) {
+    if (block >= blockIndex.size()) {
+        return false;
+    }
+
+    TraceFormat::BlockHeader header{};
+
+    file.seekg(blockIndex[block].offset);
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+    std::vector<uint8_t> compressed(header.compressedSize);
+    std::vector<uint8_t> columns(static_cast<size_t>(header.records) * sizeof(TraceRecord));
+
+    file.read(reinterpret_cast<char*>(compressed.data()), compressed.size());
+
+    if (!file || !decompress(compressed.data(), compressed.size(), columns.data(), columns.size())) {
+        return false;
+    }
+
+    decodeColumns(columns, header.records, records);
+    return true;
+}
+
+//Frame 0 starts at the stream's first block, and every later frame right after the previous
+//one's last record. The index says which block holds that record, and the block is read to find it
+bool TraceReader::findFrame(uint32_t stream, uint64_t frame, size_t& block, size_t& record) {
+    for (size_t i = 0; i < blockIndex.size(); ++i) {
+
+        TraceFormat::BlockEntry const& entry = blockIndex[i];
+
+        if (entry.stream != stream) {
+            continue;
+        }
+
+        if (frame == 0) {
+            block = i;
+            record = 0;
+            return true;
+        }
+
+        if (frame - 1 < entry.firstFrame || frame - 1 >= entry.firstFrame + entry.frames) {
+            continue;
+        }
+
+        std::vector<TraceRecord> records;
+
+        if (!readBlock(i, records)) {
+            return false;
+        }
+
+        uint64_t ends = entry.firstFrame;
+
+        for (size_t j = 0; j < records.size(); ++j) {
+
+            if (!(records[j].info & TRACE_FRAME) || ends++ != frame - 1) {
+                continue;
+            }
+
+            if (j + 1 < records.size()) {
+                block = i;
+                record = j + 1;
+                return true;
+            }
+
+            //The previous frame ends its block, so the frame starts with the stream's next block, if it has one
+            for (size_t next = i + 1; next < blockIndex.size(); ++next) {
+                if (blockIndex[next].stream == stream) {
+                    block = next;
+                    record = 0;
+                    return true;
+                }
+            }
+
+            return false;
+
+        }
+
+        return false;
+
+    }
+
+    return false;
+}
@@ -0,0 +1,311 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Chip8.hpp"
+
+//Instruction traces for offline performance analysis
+//
+//TraceHooks is a hook policy (see NoHooks in Chip8.hpp) that writes a small record for every
+//instruction a machine runs: its address, opcode, the first register it changed and the first
+//address it wrote. Only the TraceChip8 machines below are built with it.
+//
+//Records are collected in a buffer that belongs to one machine, and so to the one thread running
+//it. Full buffers are handed to a TraceWriter, whose background thread delta encodes and
+//compresses them into blocks of a trace file. The file ends with an index of its blocks and the
+//frames each one ends, so a reader can jump straight to the block holding any frame.
+//TraceStats.cpp reads traces back.
+//
+//A traced machine should not be copied while it is attached, since the copy would write into the
+//same buffer
+
+
+
+
+//-------------RECORDS------------
+
+//One executed instruction, flagged if it was the last of its frame. A frame that runs no
+//instructions, such as on a halted machine, gets a record of its own
+struct TraceRecord {
+    uint16_t programCounter;
+    uint16_t opcode;
+    uint16_t writeAddress; //First byte written, if TRACE_WRITE is set
+    uint8_t info; //Flags in the high nibble, the changed register in the low nibble
+    uint8_t value; //New value of the changed register, if TRACE_REGISTER is set
+};
+
+static_assert(sizeof(TraceRecord) == 8, "Trace records are written as 8 raw bytes");
+
+enum : uint8_t {
+    TRACE_REGISTER = 0x10, //The instruction changed a register
+    TRACE_WRITE = 0x20, //The instruction wrote memory
+    TRACE_FRAME = 0x40, //The frame ends after this record
+    TRACE_NO_INSTRUCTION = 0x80 //Not an instruction, only the end of a frame that ran none
+};
+
+//Where a machine's full buffers go. TraceWriter is the implementation, declared as an interface
+//so that Chip8.cpp can build the traced machines without linking the writer
+class TraceSink {
+
+    public:
+        virtual ~TraceSink() {}
+
+        //Takes a buffer of records (if any) and returns an empty one of the same size to keep filling
+        virtual TraceRecord* exchange(uint32_t stream, TraceRecord* records, size_t count) = 0;
+
+        //Takes a machine's last buffer
+        virtual void finish(uint32_t stream, TraceRecord* records, size_t count) = 0;
+
+};
+
+
+
+
+//-------------CAPTURE------------
+
+class TraceHooks {
+
+    public:
+        static constexpr bool ENABLED = true;
+        static constexpr size_t BUFFER_RECORDS = 16384;
+
+        //Starts writing this machine's records into the sink as the given stream
+        void attach(TraceSink& traceSink, uint32_t traceStream) {
+            sink = &traceSink;
+            stream = traceStream;
+            buffer = sink->exchange(stream, nullptr, 0);
+            cursor = buffer;
+            haveRegisters = false;
+            ranInstruction = false;
+        }
+
+        //Hands over whatever is left in the buffer. Must happen before the writer is closed
+        void detach() {
+            if (sink) {
+                sink->finish(stream, buffer, cursor - buffer);
+                sink = nullptr;
+                buffer = cursor = nullptr;
+            }
+        }
+
+        bool beforeInstruction(uint16_t programCounter) {
+            current.programCounter = programCounter;
+            current.info = 0;
+            return false;
+        }
+
+        //The register compare is two 64 bit XORs, with the first differing byte found from the lowest set bit
+        void afterInstruction(uint16_t opcode, uint8_t const* registers) {
+            if (!sink) {
+                return;
+            }
+
+            uint64_t now[2];
+            memcpy(now, registers, sizeof(now));
+
+            uint64_t low = now[0] ^ lastRegisters[0];
+            uint64_t high = now[1] ^ lastRegisters[1];
+
+            if (haveRegisters && (low | high)) {
+                unsigned int reg = low ? __builtin_ctzll(low) / 8 : 8 + __builtin_ctzll(high) / 8;
+                current.info |= TRACE_REGISTER | reg;
+                current.value = registers[reg];
+            }
+
+            lastRegisters[0] = now[0];
+            lastRegisters[1] = now[1];
+            haveRegisters = true;
+
+            current.opcode = opcode;
+            push(current);
+            ranInstruction = true;
+        }
+
+        void memoryRead(uint16_t, unsigned int) {}
+
+        void memoryWrite(uint16_t address, unsigned int) {
+            if (!(current.info & TRACE_WRITE)) {
+                current.info |= TRACE_WRITE;
+                current.writeAddress = address;
+            }
+        }
+
+        //Flags the frame's last instruction, so marking frames adds no records. The frontend ends a
+        //frame after every instruction, where a record per marker would double the trace
+        void endFrame() {
+            if (!sink) {
+                return;
+            }
+
+            if (ranInstruction) {
+                cursor[-1].info |= TRACE_FRAME;
+            }
+            else {
+                push(TraceRecord{ 0, 0, 0, TRACE_FRAME | TRACE_NO_INSTRUCTION, 0 });
+            }
+
+            ranInstruction = false;
+        }
+
+    private:
+        //A full buffer is only handed over when the next record needs room, so the last record
+        //pushed is always still in the buffer for endFrame() to flag
+        void push(TraceRecord const& record) {
+            if (cursor == buffer + BUFFER_RECORDS) {
+                buffer = sink->exchange(stream, buffer, BUFFER_RECORDS);
+                cursor = buffer;
+            }
+
+            *cursor++ = record;
+        }
+
+        TraceSink* sink{};
+        uint32_t stream{};
+        TraceRecord* buffer{};
+        TraceRecord* cursor{};
+
+        TraceRecord current{};
+        uint64_t lastRegisters[2]{}; //Registers after the previous instruction, in machine byte order
+        bool haveRegisters{};
+        bool ranInstruction{}; //Since the last endFrame()
+
+};
+
+//The traceable machines, the same as the normal ones apart from their hooks
+struct TraceChip8Config : Chip8Config {
+    typedef TraceHooks Hooks;
+};
+
+struct TraceSuperChip8Config : SuperChip8Config {
+    typedef TraceHooks Hooks;
+};
+
+struct TraceXOChip8Config : XOChip8Config {
+    typedef TraceHooks Hooks;
+};
+
+typedef Chip8Machine<TraceChip8Config> TraceChip8;
+typedef Chip8Machine<TraceSuperChip8Config> TraceSuperChip8;
+typedef Chip8Machine<TraceXOChip8Config> TraceXOChip8;
+
+
+
+
+//-------------TRACE FILES------------
+
+//File layout, all in the host's byte order:
+//  FileHeader
+//  BlockHeader and compressed records, once per block
+//  BlockEntry for every block
+//  Trailer
+namespace TraceFormat {
+
+    struct FileHeader {
+        char magic[8]; //"C8TRACE"
+        uint32_t version;
+        uint32_t recordSize;
+    };
+
+    struct BlockHeader {
+        uint32_t stream;
+        uint32_t records;
+        uint32_t compressedSize;
+        uint32_t reserved;
+        uint64_t firstRecord; //Index of the block's first record within its stream
+    };
+
+    //Frames are counted within each stream from 0. The index only counts the frames ending in each
+    //block rather than listing every frame, since with short frames a list would outgrow the
+    //compressed records themselves
+    struct BlockEntry {
+        uint64_t offset; //Of the block header
+        uint64_t firstRecord;
+        uint64_t firstFrame; //Frames the stream had ended before this block
+        uint32_t stream;
+        uint32_t records;
+        uint32_t frames; //Records flagged TRACE_FRAME in this block
+        uint32_t reserved;
+    };
+
+    struct Trailer {
+        uint64_t indexOffset;
+        uint64_t blockCount;
+        char magic[8]; //"C8INDEX"
+    };
+
+    const uint32_t VERSION = 2; //1 wrote frame ends as records of their own
+
+}
+
+//Compresses buffers handed over by traced machines on a background thread and writes them out
+class TraceWriter : public TraceSink {
+
+    public:
+        explicit TraceWriter(char const* path);
+        ~TraceWriter();
+
+        bool ok() const { return file != nullptr; }
+        uint32_t newStream(); //A stream number for one more traced machine
+        void close(); //Writes everything still queued and the index. Machines must be detached first
+
+        TraceRecord* exchange(uint32_t stream, TraceRecord* records, size_t count) override;
+        void finish(uint32_t stream, TraceRecord* records, size_t count) override;
+
+    private:
+        struct Job {
+            uint32_t stream;
+            TraceRecord* records;
+            size_t count;
+        };
+
+        static constexpr size_t MAX_QUEUED = 64; //Full buffers waiting before machines have to wait for the writer
+
+        void run();
+        void writeBlock(Job const& job);
+
+        FILE* file{};
+
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::deque<Job> queue; //Guarded by mutex
+        std::vector<TraceRecord*> spare; //Empty buffers to hand out again, guarded by mutex
+        bool closing{}; //Guarded by mutex
+        uint32_t streams{}; //Guarded by mutex
+
+        //Only touched by the writer thread
+        std::vector<uint64_t> streamRecords; //Records written so far in each stream
+        std::vector<uint64_t> streamFrames;
+        std::vector<TraceFormat::BlockEntry> blocks;
+        std::vector<uint8_t> columns;
+        std::vector<uint8_t> compressed;
+
+        std::thread thread; //Started last, once everything it uses is constructed
+
+};
+
+//Reads a trace file back, one block at a time
+class TraceReader {
+
+    public:
+        bool open(char const* path);
+
+        std::vector<TraceFormat::BlockEntry> const& blocks() const { return blockIndex; }
+
+        bool readBlock(size_t block, std::vector<TraceRecord>& records);
+
+        //Where the stream's frame starts, as a block and a record within it. False if there is no such frame
+        bool findFrame(uint32_t stream, uint64_t frame, size_t& block, size_t& record);
+
+    private:
+        std::ifstream file;
+        std::vector<TraceFormat::BlockEntry> blockIndex;
+
+};
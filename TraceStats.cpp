@@ -0,0 +1,158 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <vector>
+
+#include "Trace.hpp"
+
+//Prints statistics from a trace file written by TraceWriter, without running the ROM again
+//
+//With a stream and frame range it uses the trace's frame index to seek straight to the first
+//frame, and only decompresses the blocks the range covers
+
+
+
+
+//-------------COUNTING------------
+
+struct Stats {
+    uint64_t instructions{};
+    uint64_t frames{};
+    uint64_t registerChanges[16]{};
+    uint64_t writes{};
+    uint64_t opcodeGroups[16]{}; //By the opcode's first hex digit
+    std::map<uint16_t, uint64_t> addresses; //Instructions run at each address
+};
+
+void count(Stats& stats, TraceRecord const& record) {
+    if (record.info & TRACE_FRAME) {
+        ++stats.frames;
+    }
+    if (record.info & TRACE_NO_INSTRUCTION) {
+        return;
+    }
+
+    ++stats.instructions;
+    ++stats.opcodeGroups[record.opcode >> 12u];
+    ++stats.addresses[record.programCounter];
+
+    if (record.info & TRACE_REGISTER) {
+        ++stats.registerChanges[record.info & 0x0Fu];
+    }
+    if (record.info & TRACE_WRITE) {
+        ++stats.writes;
+    }
+}
+
+void print(Stats const& stats) {
+    std::cout << "Instructions: " << stats.instructions << "\n";
+    std::cout << "Frames: " << stats.frames << "\n";
+
+    if (stats.frames > 0) {
+        std::cout << "Instructions per frame: " << static_cast<double>(stats.instructions) / stats.frames << "\n";
+    }
+
+    std::cout << "Memory writes: " << stats.writes << "\n";
+
+    std::cout << "\nOpcode groups:\n";
+    for (unsigned int group = 0; group < 16; ++group) {
+        if (stats.opcodeGroups[group] > 0) {
+            std::cout << "  " << std::hex << std::uppercase << group << "xxx" << std::dec << "  " << stats.opcodeGroups[group] << "\n";
+        }
+    }
+
+    std::cout << "\nRegister changes:\n";
+    for (unsigned int reg = 0; reg < 16; ++reg) {
+        if (stats.registerChanges[reg] > 0) {
+            std::cout << "  V" << std::hex << std::uppercase << reg << std::dec << "  " << stats.registerChanges[reg] << "\n";
+        }
+    }
+
+    //The hottest addresses, which is where the ROM spends its time
+    std::vector<std::pair<uint64_t, uint16_t>> hottest;
+    for (auto const& address : stats.addresses) {
+        hottest.emplace_back(address.second, address.first);
+    }
+    std::sort(hottest.rbegin(), hottest.rend());
+
+    std::cout << "\nHottest addresses:\n";
+    for (size_t i = 0; i < hottest.size() && i < 10; ++i) {
+        std::cout << "  0x" << std::hex << std::uppercase << std::setw(4) << std::setfill('0') << hottest[i].second
+                  << std::dec << std::setfill(' ') << "  " << hottest[i].first << "\n";
+    }
+}
+
+
+
+
+int main(int argc, char** argv) {
+
+    if (argc != 2 && argc != 5) {
+        std::cerr << "Usage: " << argv[0] << " <Trace> [Stream FirstFrame Frames]\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    TraceReader reader;
+
+    if (!reader.open(argv[1])) {
+        std::cerr << "Could not read trace " << argv[1] << "\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    Stats stats;
+    std::vector<TraceRecord> records;
+
+    //The whole trace, every stream
+    if (argc == 2) {
+        for (size_t block = 0; block < reader.blocks().size(); ++block) {
+            if (!reader.readBlock(block, records)) {
+                std::cerr << "Block " << block << " is corrupt\n";
+                std::exit(EXIT_FAILURE);
+            }
+
+            for (TraceRecord const& record : records) {
+                count(stats, record);
+            }
+        }
+
+        std::cout << "Blocks: " << reader.blocks().size() << "\n";
+        print(stats);
+        return 0;
+    }
+
+    uint32_t stream = std::strtoul(argv[2], nullptr, 10);
+    uint64_t firstFrame = std::strtoull(argv[3], nullptr, 10);
+    uint64_t frames = std::strtoull(argv[4], nullptr, 10);
+
+    size_t block;
+    size_t record;
+
+    if (!reader.findFrame(stream, firstFrame, block, record)) {
+        std::cerr << "Stream " << stream << " has no frame " << firstFrame << "\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    //Reads on through the stream's blocks until enough frames have ended
+    for (; block < reader.blocks().size() && stats.frames < frames; ++block, record = 0) {
+
+        if (reader.blocks()[block].stream != stream) {
+            continue;
+        }
+        if (!reader.readBlock(block, records)) {
+            std::cerr << "Block " << block << " is corrupt\n";
+            std::exit(EXIT_FAILURE);
+        }
+
+        for (; record < records.size() && stats.frames < frames; ++record) {
+            count(stats, records[record]);
+        }
+
+    }
+
+    print(stats);
+    return 0;
+
+}